@@ -0,0 +1,148 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Stage timers and counters for the filter loop. See FilterStats.h
+*/
+
+#include "FilterStats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct filter_stats filterStats;
+struct stats_counter *statsWorker;
+
+static int n_counters;
+static FILE *dump_file;
+static int dump_json;
+static int dump_every;
+
+static const char *stage_names[STAGE_COUNT]={"predict","sense","normalize","clusters","resample","convergence","render"};
+
+double statsClock(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+const char *statsStageName(enum filter_stage stage)
+{
+    return stage_names[stage];
+}
+
+int statsEnable(int n_workers, const char *dump, int every)
+{
+    memset(&filterStats,0,sizeof(filterStats));
+    if (n_workers<1) n_workers=1;
+    statsWorker=(struct stats_counter *)calloc(n_workers,sizeof(struct stats_counter));
+    if (statsWorker==NULL) return -1;
+    n_counters=n_workers;
+
+    if (dump!=NULL)
+    {
+        size_t len=strlen(dump);
+        dump_file=fopen(dump,"w");
+        if (dump_file==NULL)
+        {
+            free(statsWorker);
+            statsWorker=NULL;
+            return -1;
+        }
+        dump_json=(len>=5&&!strcmp(dump+len-5,".json"));
+        dump_every=(every<1)?1:every;
+        if (!dump_json)
+        {
+            fprintf(dump_file,"iteration");
+            for (int s=0; s<STAGE_COUNT; s++) fprintf(dump_file,",%s_ms",stage_names[s]);
+            fprintf(dump_file,",bounce_retries,injected,zero_weight,ess\n");
+        }
+    }
+    filterStats.enabled=1;
+    return 0;
+}
+
+void statsDisable(void)
+{
+    if (dump_file!=NULL) fclose(dump_file);
+    dump_file=NULL;
+    free(statsWorker);
+    statsWorker=NULL;
+    filterStats.enabled=0;
+}
+
+void statsWeights(const double *w, int n)
+{
+    if (!filterStats.enabled) return;
+
+    double sum2=0.0;
+    long zero=0;
+    for (int i=0; i<n; i++)
+    {
+        sum2+=w[i]*w[i];
+        zero+=(w[i]==0.0);
+    }
+    filterStats.ess=(sum2>0.0)?1.0/sum2:0.0;
+    filterStats.zero_weight=zero;
+}
+
+static void dump(void)
+{
+    struct filter_stats *st=&filterStats;
+
+    if (dump_json)
+    {
+        fprintf(dump_file,"{\"iteration\":%lu,\"stage_ms\":{",st->iterations);
+        for (int s=0; s<STAGE_COUNT; s++)
+            fprintf(dump_file,"%s\"%s\":%.4f",s?",":"",stage_names[s],st->stage_ms[s]);
+        fprintf(dump_file,"},\"bounce_retries\":%ld,\"injected\":%ld,\"zero_weight\":%ld,\"ess\":%.2f}\n",
+                st->bounce_retries,st->injected,st->zero_weight,st->ess);
+    }
+    else
+    {
+        fprintf(dump_file,"%lu",st->iterations);
+        for (int s=0; s<STAGE_COUNT; s++) fprintf(dump_file,",%.4f",st->stage_ms[s]);
+        fprintf(dump_file,",%ld,%ld,%ld,%.2f\n",st->bounce_retries,st->injected,st->zero_weight,st->ess);
+    }
+}
+
+void statsEndIteration(void)
+{
+    struct filter_stats *st=&filterStats;
+    if (!st->enabled) return;
+
+    for (int w=0; w<n_counters; w++)
+    {
+        st->bounce_retries+=statsWorker[w].bounces;
+        statsWorker[w].bounces=0;
+    }
+
+    st->iterations++;
+    for (int s=0; s<STAGE_COUNT; s++) st->total_ms[s]+=st->stage_ms[s];
+    st->total_bounce_retries+=st->bounce_retries;
+    st->total_injected+=st->injected;
+    st->total_zero_weight+=st->zero_weight;
+
+    if (dump_file!=NULL&&st->iterations%dump_every==0) dump();
+
+    memset(st->stage_ms,0,sizeof(st->stage_ms));
+    st->bounce_retries=0;
+    st->injected=0;
+    st->zero_weight=0;
+}
+
+void statsPrintSummary(FILE *f)
+{
+    struct filter_stats *st=&filterStats;
+    double total=0.0;
+
+    if (!st->enabled||st->iterations==0) return;
+    for (int s=0; s<STAGE_COUNT; s++) total+=st->total_ms[s];
+
+    fprintf(f,"Stage timings over %lu iterations (mean ms per iteration):\n",st->iterations);
+    for (int s=0; s<STAGE_COUNT; s++)
+        fprintf(f,"  %-12s %10.4f  %5.1f%%\n",stage_names[s],st->total_ms[s]/st->iterations,
+                total>0.0?100.0*st->total_ms[s]/total:0.0);
+    fprintf(f,"Bounce retries %ld, injected particles %ld, zero-weight particles %ld, last ESS %.1f\n",
+            st->total_bounce_retries,st->total_injected,st->total_zero_weight,st->ess);
+}
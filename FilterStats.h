@@ -0,0 +1,109 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Stage timers and counters for the filter loop.
+
+  Each step of an iteration (predict, sense, normalize, pose
+  clusters, resample, convergence check, render) is timed, and a
+  few events are counted: wall-bounce retries in Step 1, random
+  particles injected by resample(), particles whose belief
+  underflowed to zero, and the effective sample size 1/sum(w^2)
+  after normalization.
+
+  Everything is off unless statsEnable() is called. When disabled
+  each probe is a single predictable branch on a global flag: no
+  clock reads, no extra passes over the particles.
+
+  With a dump file the stats are appended every 'every' iterations,
+  either as JSON (one object per line, if the file name ends in
+  .json) or CSV.
+*/
+
+#ifndef __FilterStats_header
+#define __FilterStats_header
+
+#include <stdio.h>
+
+enum filter_stage{
+ STAGE_PREDICT,			// Steps 1+3 for the particles (fused)
+ STAGE_SENSE,			// Robot move + Step 2: robot sonar
+ STAGE_NORMALIZE,		// Step 3: beliefs
+ STAGE_CLUSTERS,		// Pose clusters (with --clusters only)
+ STAGE_RESAMPLE,		// Step 4
+ STAGE_CONVERGENCE,		// Convergence test
+ STAGE_RENDER,			// Viewer snapshot (viewer only)
+ STAGE_COUNT
+};
+
+struct filter_stats{
+ int enabled;
+ unsigned long iterations;	// Iterations recorded so far
+ // Last iteration
+ double stage_ms[STAGE_COUNT];
+ long bounce_retries;
+ long injected;
+ long zero_weight;
+ double ess;			// Effective sample size
+ // Totals over all iterations
+ double total_ms[STAGE_COUNT];
+ long total_bounce_retries;
+ long total_injected;
+ long total_zero_weight;
+};
+
+extern struct filter_stats filterStats;
+
+// Start collecting. 'n_workers' is the number of pool workers that
+// may report bounce retries. If 'dump' is not NULL stats are appended
+// to that file every 'every' iterations. Returns 0 on success.
+int statsEnable(int n_workers, const char *dump, int every);
+
+// Flush and close the dump file
+void statsDisable(void);
+
+// Current time in seconds (monotonic), for stage timing
+double statsClock(void);
+
+// Time a stage:  double t=statsBegin(); ...; statsEnd(STAGE_x,t);
+static inline double statsBegin(void)
+{
+ return filterStats.enabled?statsClock():0.0;
+}
+
+static inline void statsEnd(enum filter_stage stage, double t0)
+{
+ if (filterStats.enabled) filterStats.stage_ms[stage]+=1000.0*(statsClock()-t0);
+}
+
+// Per-worker bounce retry counters (one cache line each)
+struct stats_counter{
+ long bounces;
+ char pad[64-sizeof(long)];
+};
+extern struct stats_counter *statsWorker;
+
+static inline void statsBounces(int worker, long n)
+{
+ if (filterStats.enabled) statsWorker[worker].bounces+=n;
+}
+
+static inline void statsInjected(long n)
+{
+ if (filterStats.enabled) filterStats.injected+=n;
+}
+
+// Record effective sample size and zero-weight count for normalized
+// beliefs w[0..n-1] (one pass, only when enabled)
+void statsWeights(const double *w, int n);
+
+// Close the current iteration: fold in worker counters, update the
+// totals, dump if due, and reset the per-iteration values
+void statsEndIteration(void);
+
+// Name of a stage
+const char *statsStageName(enum filter_stage stage);
+
+// Print a summary of the totals
+void statsPrintSummary(FILE *f);
+
+#endif
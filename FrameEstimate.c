@@ -0,0 +1,186 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Weighted reductions of the particle set. See FrameEstimate.h
+*/
+
+#include "FrameEstimate.h"
+
+static inline double wrap180(double d)
+{
+    // An angle difference of two headings in [0, 360] into [-180, 180)
+    d+=(d<-180.0)?360.0:0.0;
+    d-=(d>=180.0)?360.0:0.0;
+    return d;
+}
+
+static inline double wrap360(double t)
+{
+    t+=(t<0.0)?360.0:0.0;
+    t-=(t>=360.0)?360.0:0.0;
+    return t;
+}
+
+void momentsClear(struct weight_moments *m)
+{
+    memset(m,0,sizeof(struct weight_moments));
+    m->shift=-HUGE_VAL;
+}
+
+void momentsBlock(struct weight_moments *m, double *w, const pf_pose *x, const pf_pose *y, const pf_pose *theta, int n,
+                  int first)
+{
+    momentsClear(m);
+    if (n<=0) return;
+
+    // The block is small and hot, so finding its largest weight
+    // first costs less than rescaling the sums on the way
+    for (int i=0; i<n; i++)
+        if (w[i]>m->shift&&w[i]<HUGE_VAL)
+        {
+            m->shift=w[i];
+            m->best=first+i;
+            m->best_x=x[i];
+            m->best_y=y[i];
+            m->best_theta=theta[i];
+        }
+
+    // Plain sums about the first particle and weighted sums about the
+    // best one: both are close to the block, so the squares lose
+    // nothing, and no division is needed per particle
+    double x0=x[0], y0=y[0];
+    double sx=0.0, sy=0.0, sxx=0.0, syy=0.0;
+    double bx=m->best_x, by=m->best_y;
+    double bt=m->best_theta;
+    double wx=0.0, wy=0.0, wxx=0.0, wyy=0.0, wxy=0.0, wt=0.0, wtt=0.0;
+    for (int i=0; i<n; i++)
+    {
+        double ux=x[i]-x0, uy=y[i]-y0;
+        sx+=ux;
+        sy+=uy;
+        sxx+=ux*ux;
+        syy+=uy*uy;
+
+        // Weights that underflowed (or were never finite) add nothing,
+        // and those below FRAME_TINY are left out of the moments
+        double wi=(w[i]>-HUGE_VAL&&w[i]<HUGE_VAL)?exp(w[i]-m->shift):0.0;
+        w[i]=wi;
+        m->sum+=wi;
+        m->sum2+=wi*wi;
+        if (wi<FRAME_TINY) continue;
+        double dx=x[i]-bx, dy=y[i]-by;
+        wx+=wi*dx;
+        wy+=wi*dy;
+        wxx+=wi*dx*dx;
+        wyy+=wi*dy*dy;
+        wxy+=wi*dx*dy;
+        double dt=wrap180(theta[i]-bt);
+        wt+=wi*dt;
+        wtt+=wi*dt*dt;
+    }
+
+    // Into the mean and co-moment form that momentsMerge() works with
+    m->n=n;
+    m->ux=x0+sx/n;
+    m->uy=y0+sy/n;
+    m->uxx=sxx-sx*sx/n;
+    m->uyy=syy-sy*sy/n;
+    if (m->sum==0.0) return;
+    m->mx=bx+wx/m->sum;
+    m->my=by+wy/m->sum;
+    m->cxx=wxx-wx*wx/m->sum;
+    m->cyy=wyy-wy*wy/m->sum;
+    m->cxy=wxy-wx*wy/m->sum;
+    m->mt=wrap360(bt+wt/m->sum);
+    m->ctt=wtt-wt*wt/m->sum;
+}
+
+static void mergePlain(struct weight_moments *a, const struct weight_moments *b)
+{
+    if (b->n==0.0) return;
+    double n=a->n+b->n;
+    double dx=b->ux-a->ux, dy=b->uy-a->uy;
+    double f=b->n/n, g=a->n*b->n/n;
+    a->ux+=f*dx;
+    a->uy+=f*dy;
+    a->uxx+=b->uxx+g*dx*dx;
+    a->uyy+=b->uyy+g*dy*dy;
+    a->n=n;
+}
+
+void momentsMerge(struct weight_moments *a, const struct weight_moments *b)
+{
+    mergePlain(a,b);
+    if (b->sum==0.0) return;
+    if (a->sum==0.0)
+    {
+        // Take b's weighted part as it is
+        a->shift=b->shift;
+        a->sum=b->sum;
+        a->sum2=b->sum2;
+        a->mx=b->mx;
+        a->my=b->my;
+        a->cxx=b->cxx;
+        a->cyy=b->cyy;
+        a->cxy=b->cxy;
+        a->mt=b->mt;
+        a->ctt=b->ctt;
+        a->best=b->best;
+        a->best_x=b->best_x;
+        a->best_y=b->best_y;
+        a->best_theta=b->best_theta;
+        return;
+    }
+
+    // Bring both to the larger shift
+    double shift=(b->shift>a->shift)?b->shift:a->shift;
+    double ea=exp(a->shift-shift), eb=exp(b->shift-shift);
+    double sa=a->sum*ea, sb=b->sum*eb, s=sa+sb;
+    double dx=b->mx-a->mx, dy=b->my-a->my, dt=wrap180(b->mt-a->mt);
+    double f=sb/s, g=sa*sb/s;
+
+    a->mx+=f*dx;
+    a->my+=f*dy;
+    a->mt=wrap360(a->mt+f*dt);
+    a->cxx=a->cxx*ea+b->cxx*eb+g*dx*dx;
+    a->cyy=a->cyy*ea+b->cyy*eb+g*dy*dy;
+    a->cxy=a->cxy*ea+b->cxy*eb+g*dx*dy;
+    a->ctt=a->ctt*ea+b->ctt*eb+g*dt*dt;
+    a->sum=s;
+    a->sum2=a->sum2*ea*ea+b->sum2*eb*eb;
+    if (b->shift>a->shift)
+    {
+        a->best=b->best;
+        a->best_x=b->best_x;
+        a->best_y=b->best_y;
+        a->best_theta=b->best_theta;
+    }
+    a->shift=shift;
+}
+
+void finishEstimate(struct frame_estimate *e, const struct weight_moments *m)
+{
+    memset(e,0,sizeof(struct frame_estimate));
+    if (m->n>0.0)
+    {
+        e->set_var_x=m->uxx/m->n;
+        e->set_var_y=m->uyy/m->n;
+    }
+    if (m->sum==0.0) return;
+
+    e->valid=1;
+    e->log_sum=m->shift+log(m->sum);
+    e->ess=m->sum*m->sum/m->sum2;
+    e->x=m->mx;
+    e->y=m->my;
+    e->var_x=m->cxx/m->sum;
+    e->var_y=m->cyy/m->sum;
+    e->cov_xy=m->cxy/m->sum;
+    e->theta=m->mt;
+    e->var_theta=m->ctt/m->sum;
+    e->best=m->best;
+    e->best_x=m->best_x;
+    e->best_y=m->best_y;
+    e->best_theta=m->best_theta;
+    e->best_belief=1.0/m->sum;	// Its weight is exactly 1
+}
@@ -0,0 +1,117 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Weighted reductions of the particle set, taken in the same pass
+  that moves and weights the particles.
+
+  A frame used to go over the whole set once per question: the
+  maximum log-likelihood, the sum of the shifted weights and the
+  scaling for the normalization, the sum of squares for the
+  effective sample size, two more passes for the variance in
+  isCentralized() and one for the highest-belief particle. Each
+  pass reloads every particle from memory.
+
+  Instead, each block of particles is summarized as soon as it has
+  been weighted, while it is still in cache (momentsBlock()):
+
+   shift        the largest log-likelihood l_i of the block, and
+                the particle that has it
+   sum, sum2    sum of w_i and w_i^2, with w_i = exp(l_i - shift)
+   mean         weighted mean pose
+   cxx..ctt     weighted co-moments of x, y and theta about it
+   n, ux..uyy   count, plain mean and co-moments of the position
+
+  Headings are averaged as offsets from the block's best particle,
+  wrapped to [-180, 180) degrees, and offsets between block means
+  are wrapped the same way when merging. That needs no trig per
+  particle and is exact for a set whose headings are within 180
+  degrees of each other, which is when the mean heading means
+  anything; for headings spread all round, var_theta says so.
+
+  Within a block the moments are plain sums about a particle of the
+  block, which is as accurate as Welford's update over a few hundred
+  nearby particles and needs no division per particle. Particles
+  whose weight is below FRAME_TINY times the block's largest are
+  left out of the moments (not of the sums of weights): with this
+  sonar model that is most of them, and together they move the mean
+  by less than n*FRAME_TINY of the spread.
+
+  The block's log-likelihoods are replaced by the w_i, which are at
+  most 1 and cannot overflow, as in logNormalize(). Turning them
+  into beliefs later is one multiply per particle by
+  exp(shift - log_sum) of its block (see blockScale()).
+
+  Block summaries are merged with the parallel form of the update
+  (Chan et al.), rescaling the sums to the larger shift, in block
+  order, so the result does not depend on which worker ran which
+  block. finishEstimate() turns the merged summary into the frame
+  estimate. Everything the filter asks about the weights afterwards
+  is then an O(1) read: the log normalizer, the effective sample
+  size, the weighted mean and covariance of the position, the mean
+  heading and the best particle.
+
+  The plain (unweighted) variance is what isCentralized() measures,
+  and it is kept for the convergence test: with this sonar model
+  the weights collapse onto a handful of particles in the first
+  frames, so the weighted variance is small long before the cloud
+  has gathered around one place. It is the variance of the set as
+  it was weighted, before resampling, i.e. of the previous frame's
+  resampled set after one more step: the test lags isCentralized()
+  on the freshly resampled set by one frame.
+*/
+
+#ifndef __FrameEstimate_header
+#define __FrameEstimate_header
+
+#include "ParticleStore.h"
+
+#define FRAME_TINY 1e-12	// Relative weight below which moments skip a particle
+
+struct weight_moments{
+ double shift;			// Largest log-likelihood
+ double sum, sum2;		// Sums of w and w^2, w=exp(l-shift)
+ double mx, my, mt;		// Weighted mean pose (mt in degrees)
+ double cxx, cyy, cxy, ctt;	// Weighted co-moments about it
+ double n;			// Particles summarized
+ double ux, uy, uxx, uyy;	// Plain mean and co-moments of the position
+ double best_x, best_y, best_theta;	// Particle with l=shift
+ int best;			// and its index
+};
+
+struct frame_estimate{
+ int valid;			// Some particle had a finite weight
+ double log_sum;		// log sum_i exp(l_i), the normalizer
+ double ess;			// Effective sample size 1/sum(b_i^2)
+ double x, y, theta;		// Weighted mean pose (theta in degrees)
+ double var_x, var_y, cov_xy;	// Weighted covariance of the position
+ double var_theta;		// and of the heading, in degrees^2
+ double set_var_x, set_var_y;	// Unweighted variance of the position
+ double best_x, best_y, best_theta;	// Highest-belief particle
+ double best_belief;		// and its belief
+ int best;			// Its index in the (pre-resampling) set
+};
+
+// Empty summary
+void momentsClear(struct weight_moments *m);
+
+// Summarize the n particles at (x[i], y[i], theta[i]) whose
+// log-likelihoods are in w[], the first of them being particle
+// 'first' of the set. On return w[i] = exp(w[i] - m->shift), or 0
+// if w[i] was not finite.
+void momentsBlock(struct weight_moments *m, double *w, const pf_pose *x, const pf_pose *y, const pf_pose *theta, int n,
+                  int first);
+
+// Merge summary b into a. Ties for the best particle go to a.
+void momentsMerge(struct weight_moments *a, const struct weight_moments *b);
+
+// Estimate from the summary of the whole set
+void finishEstimate(struct frame_estimate *e, const struct weight_moments *m);
+
+// What the weights of a block summarized by m are multiplied by to
+// make them beliefs, given the estimate of the whole set
+static inline double blockScale(const struct weight_moments *m, const struct frame_estimate *e)
+{
+ return (m->sum>0.0)?exp(m->shift-e->log_sum):0.0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Free-space index. See FreeSpace.h
+*/
+
+#include "FreeSpace.h"
+#include <stdlib.h>
+#include <string.h>
+
+int buildFreeSpace(struct free_space *f, const unsigned char *map, int sx, int sy)
+{
+    size_t pixels=(size_t)sx*sy;
+    size_t n=0;
+
+    memset(f,0,sizeof(struct free_space));
+
+    // Count first so the index is allocated exactly once
+    for (size_t i=0; i<pixels; i++)
+        n+=(map[3*i]|map[3*i+1]|map[3*i+2])==0;
+    if (n==0) return -1;
+
+    f->cell=(unsigned int *)malloc(n*sizeof(unsigned int));
+    if (f->cell==NULL) return -1;
+
+    n=0;
+    for (size_t i=0; i<pixels; i++)
+        if ((map[3*i]|map[3*i+1]|map[3*i+2])==0) f->cell[n++]=(unsigned int)i;
+
+    f->sx=sx;
+    f->sy=sy;
+    f->n=(int)n;
+    return 0;
+}
+
+void freeFreeSpace(struct free_space *f)
+{
+    free(f->cell);
+    memset(f,0,sizeof(struct free_space));
+}
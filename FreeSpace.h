@@ -0,0 +1,48 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Free-space index for uniform particle placement.
+
+  Placing a particle uniformly over the free space used to be done
+  by rejection: pick a random pixel, call hit(), try again if it is
+  a wall. On wall-dense maps that takes several hit() calls per
+  particle, and an unlucky particle can take many more.
+
+  The index is a compacted array of every free (black) pixel,
+  built once when the map is loaded. A uniform free position is
+  then one random draw and one array read, with no retries, and
+  exactly the same distribution as the rejection loop (uniform
+  over free pixels, at integer coordinates).
+
+  Pixels are stored as y*sx+x in 32 bits: 4 bytes per free pixel,
+  at most 4 MB for a 1024x1024 map.
+*/
+
+#ifndef __FreeSpace_header
+#define __FreeSpace_header
+
+#include "ParticleStore.h"
+
+struct free_space{
+ int sx,sy;			// Size of the map in pixels
+ int n;				// Number of free pixels
+ unsigned int *cell;		// y*sx+x of each free pixel
+};
+
+// Index the free pixels of an sx x sy RGB map. Returns 0 on
+// success, -1 if memory runs out or the map has no free pixel.
+int buildFreeSpace(struct free_space *f, const unsigned char *map, int sx, int sy);
+
+// Release the index
+void freeFreeSpace(struct free_space *f);
+
+// Free pixel for a uniform number u in [0,1)
+static inline void freeSpacePick(const struct free_space *f, double u, pf_pose *x, pf_pose *y)
+{
+ int i=(int)(u*f->n);
+ if (i>=f->n) i=f->n-1;
+ *x=(pf_pose)(f->cell[i]%f->sx);
+ *y=(pf_pose)(f->cell[i]/f->sx);
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  KLD-sampling. See KldSampling.h
+*/
+
+#include "KldSampling.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+int initKld(struct kld_sampler *k, int sx, int sy, int min, int max, double epsilon, double z, double bin_xy, double bin_theta)
+{
+    memset(k,0,sizeof(struct kld_sampler));
+    if (min<1||max<min||epsilon<=0.0||bin_xy<=0.0||bin_theta<=0.0) return -1;
+
+    k->min=min;
+    k->max=max;
+    k->epsilon=epsilon;
+    k->ess_ratio=0.1;
+    k->z=z;
+    k->bin_xy=bin_xy;
+    k->bin_theta=bin_theta;
+    k->gx=(int)ceil(sx/bin_xy);
+    k->gy=(int)ceil(sy/bin_xy);
+    k->gt=(int)ceil(360.0/bin_theta);
+    if (k->gx<1) k->gx=1;
+    if (k->gy<1) k->gy=1;
+    if (k->gt<1) k->gt=1;
+
+    k->stamp=(unsigned int *)calloc((size_t)k->gx*k->gy*k->gt,sizeof(unsigned int));
+    if (k->stamp==NULL) return -1;
+    k->enabled=1;
+    return 0;
+}
+
+void freeKld(struct kld_sampler *k)
+{
+    free(k->stamp);
+    memset(k,0,sizeof(struct kld_sampler));
+}
+
+static inline int clampBin(int b, int n)
+{
+    return b<0?0:(b>=n?n-1:b);
+}
+
+int kldBins(struct kld_sampler *k, const pf_pose *x, const pf_pose *y, const pf_pose *theta, int n)
+{
+    int bins=0;
+
+    // A new generation marks every bin empty
+    if (++k->generation==0)
+    {
+        memset(k->stamp,0,(size_t)k->gx*k->gy*k->gt*sizeof(unsigned int));
+        k->generation=1;
+    }
+
+    for (int i=0; i<n; i++)
+    {
+        int bx=clampBin((int)(x[i]/k->bin_xy),k->gx);
+        int by=clampBin((int)(y[i]/k->bin_xy),k->gy);
+        int bt=clampBin((int)(theta[i]/k->bin_theta),k->gt);
+        size_t b=((size_t)bt*k->gy+by)*k->gx+bx;
+        if (k->stamp[b]!=k->generation)
+        {
+            k->stamp[b]=k->generation;
+            bins++;
+        }
+    }
+    return bins;
+}
+
+int kldSampleCount(const struct kld_sampler *k, int bins, int current, double ess)
+{
+    double n=k->min;
+
+    // Few particles agree with the measurement: the set is lost or
+    // still searching, grow it whatever the bins say
+    if (ess<k->ess_ratio*current) n=2.0*current;
+
+    // Wilson-Hilferty approximation of the chi-square quantile
+    if (bins>1)
+    {
+        double a=2.0/(9.0*(bins-1));
+        double b=1.0-a+sqrt(a)*k->z;
+        double nk=ceil((bins-1)/(2.0*k->epsilon)*b*b*b);
+        if (nk>n) n=nk;
+    }
+    if (n<k->min) n=k->min;
+    if (n>k->max) n=k->max;
+    return (int)n;
+}
@@ -0,0 +1,73 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  KLD-sampling: adapt the number of particles to the spread of the
+  belief (Fox, "Adapting the sample size in particle filters
+  through KLD-sampling", 2003).
+
+  The pose space is divided into a histogram of bins. Before each
+  resampling step we count the k bins occupied by the predicted
+  particle set (the samples Fox bins, one iteration later) and draw
+
+   n = (k-1)/(2 eps) * (1 - 2/(9(k-1)) + sqrt(2/(9(k-1))) z)^3
+
+  new particles, the number needed so that, with probability 1-delta,
+  the KL divergence between the sampled and true belief stays below
+  eps (z is the upper 1-delta quantile of the standard normal).
+  A belief spread over the whole map occupies many bins and gets
+  many particles; a tight cloud while tracking needs only a few
+  hundred. The result is clamped to [min, max].
+
+  The bins only see where particles already are, so on their own
+  they can never bring back a set that has converged on the wrong
+  place (or a robot that has been kidnapped). With this sonar model
+  the weights also collapse onto a handful of particles in the
+  first iteration, so the histogram shrinks long before the robot
+  is found. The count is therefore also doubled whenever the
+  effective sample size 1/sum(w^2) drops below ess_ratio*n: few
+  particles agree with the measurement, and more are needed.
+
+  Bins are 'bin_xy' pixels square and 'bin_theta' degrees wide.
+  The sonar model does not depend on the heading (ground_truth()
+  ignores theta), so the default is a single heading bin; binning
+  theta would only multiply k by the number of heading bins
+  without the filter ever being able to tell them apart.
+
+  Occupied bins are found with a generation-stamped grid, so no
+  clearing pass is needed between iterations: O(n) per count.
+*/
+
+#ifndef __KldSampling_header
+#define __KldSampling_header
+
+#include "ParticleStore.h"
+
+struct kld_sampler{
+ int enabled;
+ int min, max;			// Bounds on the particle count
+ double epsilon;		// KL divergence bound
+ double ess_ratio;		// Grow the set when ESS < ess_ratio * n
+ double z;			// Upper 1-delta normal quantile
+ double bin_xy;			// Bin size in pixels
+ double bin_theta;		// Bin size in degrees
+ int gx, gy, gt;		// Histogram dimensions
+ unsigned int *stamp;		// Generation that last touched each bin
+ unsigned int generation;
+};
+
+// Set up a sampler for an sx x sy map. Returns 0 on success, -1 if
+// the parameters are invalid or memory could not be allocated.
+int initKld(struct kld_sampler *k, int sx, int sy, int min, int max, double epsilon, double z, double bin_xy, double bin_theta);
+
+// Release the histogram
+void freeKld(struct kld_sampler *k);
+
+// Number of distinct bins occupied by the n poses x[], y[], theta[]
+int kldBins(struct kld_sampler *k, const pf_pose *x, const pf_pose *y, const pf_pose *theta, int n);
+
+// Particle count to draw next, within [min, max], for 'bins' occupied
+// bins and a current set of 'current' particles with effective
+// sample size 'ess'
+int kldSampleCount(const struct kld_sampler *k, int bins, int current, double ess);
+
+#endif
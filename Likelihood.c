@@ -0,0 +1,274 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Log-domain beam likelihood kernel. See Likelihood.h
+*/
+
+#include "Likelihood.h"
+
+#if defined(__x86_64__)||defined(__i386__)
+#include <immintrin.h>
+#define PF_X86 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Beam k of a Beams beam sensor points k*360/(Beams+1) degrees from
+// the +y axis, see Likelihood.h
+template<int Beams>
+struct beam_angles{
+ double deg[Beams];
+ constexpr beam_angles():deg()
+ {
+  for (int k=0; k<Beams; k++) deg[k]=k*(360.0/(Beams+1));
+ }
+};
+
+template<int Beams>
+static constexpr beam_angles<Beams> beamAngles{};
+
+// Noise models. Each gives the log density of a reading error e as
+//  norm - scale*cost(e)
+// and how to add cost(e) to a vector accumulator.
+
+// N(0, sigma^2)
+template<int Sigma>
+struct gaussian_noise{
+ static const double norm;	// log() is not constexpr, so set below
+ static constexpr double scale=1.0/(2.0*Sigma*Sigma);
+
+ static inline double cost(double e) {return e*e;}
+#ifdef PF_X86
+ static inline __m128d cost(__m128d e) {return _mm_mul_pd(e,e);}
+ __attribute__((target("avx2,fma")))
+ static inline __m256d accumulate(__m256d acc, __m256d e) {return _mm256_fmadd_pd(e,e,acc);}
+#endif
+};
+
+// Laplace with scale b = sigma/sqrt(2), so the variance is sigma^2
+template<int Sigma>
+struct laplace_noise{
+ static const double norm;
+ static constexpr double scale=M_SQRT2/Sigma;
+
+ static inline double cost(double e) {return fabs(e);}
+#ifdef PF_X86
+ static inline __m128d cost(__m128d e) {return _mm_andnot_pd(_mm_set1_pd(-0.0),e);}
+ __attribute__((target("avx2,fma")))
+ static inline __m256d accumulate(__m256d acc, __m256d e) {return _mm256_add_pd(acc,_mm256_andnot_pd(_mm256_set1_pd(-0.0),e));}
+#endif
+};
+
+template<int Sigma>
+const double gaussian_noise<Sigma>::norm=-(log((double)Sigma)+0.5*log(2.0*M_PI));
+template<int Sigma>
+const double laplace_noise<Sigma>::norm=-(log((double)Sigma)+0.5*log(2.0));
+
+typedef gaussian_noise<PF_SONAR_SIGMA> sonar_gaussian;
+typedef laplace_noise<PF_SONAR_SIGMA> sonar_laplace;
+
+template<int Beams, class Noise>
+static void batchScalar(const pf_meas *measureD, int n, const double *rob, double *out)
+{
+    for (int i=0; i<n; i++)
+    {
+        const pf_meas *m=measureD+(size_t)i*Beams;
+        double acc=0.0;
+        for (int k=0; k<Beams; k++) acc+=Noise::cost(measDecode(m[k])-rob[k]);
+        out[i]=Beams*Noise::norm-Noise::scale*acc;
+    }
+}
+
+#ifdef PF_X86
+template<int Beams, class Noise>
+static void batchSSE2(const pf_meas *measureD, int n, const double *rob, double *out)
+{
+    static_assert(Beams%4==0,"The vector kernels take 4 beams at a time");
+    for (int i=0; i<n; i++)
+    {
+        const pf_meas *m=measureD+(size_t)i*Beams;
+#ifdef PF_COMPACT
+        double a[Beams];
+        for (int k=0; k<Beams; k++) a[k]=measDecode(m[k]);
+#else
+        const double *a=m;
+#endif
+        __m128d acc0=_mm_setzero_pd();
+        __m128d acc1=_mm_setzero_pd();
+        for (int k=0; k<Beams; k+=4)
+        {
+            __m128d e0=_mm_sub_pd(_mm_loadu_pd(a+k),_mm_loadu_pd(rob+k));
+            __m128d e1=_mm_sub_pd(_mm_loadu_pd(a+k+2),_mm_loadu_pd(rob+k+2));
+            acc0=_mm_add_pd(acc0,Noise::cost(e0));
+            acc1=_mm_add_pd(acc1,Noise::cost(e1));
+        }
+        acc0=_mm_add_pd(acc0,acc1);
+        out[i]=Beams*Noise::norm-Noise::scale*_mm_cvtsd_f64(_mm_add_sd(acc0,_mm_unpackhi_pd(acc0,acc0)));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d loadMeas(const pf_meas *m)
+{
+    // Four stored readings as doubles
+#ifdef PF_COMPACT
+    __m128i q=_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)m));
+    return _mm256_mul_pd(_mm256_cvtepi32_pd(q),_mm256_set1_pd(1.0/PF_MEAS_SCALE));
+#else
+    return _mm256_loadu_pd(m);
+#endif
+}
+
+template<int Beams, class Noise>
+__attribute__((target("avx2,fma")))
+static void batchAVX2(const pf_meas *measureD, int n, const double *rob, double *out)
+{
+    static_assert(Beams%4==0,"The vector kernels take 4 beams at a time");
+    __m256d r[Beams/4];
+    for (int k=0; k<Beams/4; k++) r[k]=_mm256_loadu_pd(rob+4*k);
+
+    for (int i=0; i<n; i++)
+    {
+        const pf_meas *m=measureD+(size_t)i*Beams;
+        __m256d acc=_mm256_setzero_pd();
+        for (int k=0; k<Beams/4; k++) acc=Noise::accumulate(acc,_mm256_sub_pd(loadMeas(m+4*k),r[k]));
+        __m128d s=_mm_add_pd(_mm256_castpd256_pd128(acc),_mm256_extractf128_pd(acc,1));
+        out[i]=Beams*Noise::norm-Noise::scale*_mm_cvtsd_f64(_mm_add_sd(s,_mm_unpackhi_pd(s,s)));
+    }
+}
+#endif
+
+// Every configuration that is built, with its kernel for each ISA
+struct model_build{
+ int beams;
+ enum noise_model noise;
+ const double *angle;
+ likelihood_fn scalar, sse2, avx2;
+};
+
+#ifdef PF_X86
+#define MODEL(B,NOISE,N) {B,NOISE,beamAngles<B>.deg,batchScalar<B,N>,batchSSE2<B,N>,batchAVX2<B,N>}
+#else
+#define MODEL(B,NOISE,N) {B,NOISE,beamAngles<B>.deg,batchScalar<B,N>,NULL,NULL}
+#endif
+
+static const struct model_build builds[]={
+ MODEL(8,NOISE_GAUSSIAN,sonar_gaussian),
+ MODEL(16,NOISE_GAUSSIAN,sonar_gaussian),
+ MODEL(32,NOISE_GAUSSIAN,sonar_gaussian),
+ MODEL(64,NOISE_GAUSSIAN,sonar_gaussian),
+ MODEL(8,NOISE_LAPLACE,sonar_laplace),
+ MODEL(16,NOISE_LAPLACE,sonar_laplace),
+ MODEL(32,NOISE_LAPLACE,sonar_laplace),
+ MODEL(64,NOISE_LAPLACE,sonar_laplace),
+};
+
+#define N_MODELS ((int)(sizeof(builds)/sizeof(builds[0])))
+
+static_assert(PF_MAX_BEAMS>=64,"PF_MAX_BEAMS must fit the largest sensor model");
+
+static const char *noise_names[]={"gaussian","laplace"};
+
+static struct sensor_model models[N_MODELS];
+static const char *kernelName;
+
+static void pickKernel(void)
+{
+    // Decided once, on first use
+    if (kernelName!=NULL) return;
+    int isa=0;
+#ifdef PF_X86
+    __builtin_cpu_init();
+    isa=(__builtin_cpu_supports("avx2")&&__builtin_cpu_supports("fma"))?2:1;
+#endif
+    for (int i=0; i<N_MODELS; i++)
+    {
+        const struct model_build *b=&builds[i];
+        models[i].beams=b->beams;
+        models[i].noise=b->noise;
+        models[i].sigma=PF_SONAR_SIGMA;
+        models[i].angle=b->angle;
+        models[i].batch=(isa==2)?b->avx2:(isa==1?b->sse2:b->scalar);
+    }
+    kernelName=(isa==2)?"avx2":(isa==1?"sse2":"scalar");
+}
+
+const struct sensor_model *findSensorModel(int beams, enum noise_model noise)
+{
+    pickKernel();
+    for (int i=0; i<N_MODELS; i++)
+        if (models[i].beams==beams&&models[i].noise==noise) return &models[i];
+    return NULL;
+}
+
+const struct sensor_model *sensorModelAt(int i)
+{
+    pickKernel();
+    return (i>=0&&i<N_MODELS)?&models[i]:NULL;
+}
+
+double logLikelihood(const struct sensor_model *model, const pf_meas *measureD, const double *rob)
+{
+    double out;
+    model->batch(measureD,1,rob,&out);
+    return out;
+}
+
+int noiseModelFromName(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(noise_names)/sizeof(noise_names[0])); i++)
+        if (!strcmp(name,noise_names[i])) return i;
+    return -1;
+}
+
+const char *noiseModelName(enum noise_model noise)
+{
+    return noise_names[noise];
+}
+
+struct shift_job{
+ double *w;
+ double shift;
+};
+
+static void expShift(void *arg, int begin, int end, int chunk, int worker)
+{
+    struct shift_job *job=(struct shift_job *)arg;
+    for (int i=begin; i<end; i++) job->w[i]=exp(job->w[i]-job->shift);
+}
+
+static void scale(void *arg, int begin, int end, int chunk, int worker)
+{
+    struct shift_job *job=(struct shift_job *)arg;
+    for (int i=begin; i<end; i++) job->w[i]*=job->shift;
+}
+
+void logNormalize(struct thread_pool *pool, double *w, int n)
+{
+    struct shift_job job;
+    int chunk=poolChunkSize(pool,n,1024);
+
+    if (n<=0) return;
+    job.w=w;
+    job.shift=poolMax(pool,w,n);
+    if (!isfinite(job.shift))
+    {
+        // Nothing usable to normalize, fall back to uniform beliefs
+        for (int i=0; i<n; i++) w[i]=1.0/n;
+        return;
+    }
+
+    // After the shift the largest weight is exactly 1, so the sum is
+    // in [1, n] and the division below is always safe.
+    poolRun(pool,expShift,&job,n,chunk);
+    job.shift=1.0/poolSum(pool,w,n);
+    poolRun(pool,scale,&job,n,chunk);
+}
+
+const char *likelihoodKernel(void)
+{
+    pickKernel();
+    return kernelName;
+}
@@ -0,0 +1,88 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Log-domain beam likelihood kernels (sensor models).
+
+  The likelihood of a particle is the product of one PDF per sonar
+  slice. With sigma=20 the product of sixteen small densities
+  regularly underflows to zero, so the kernels work with its
+  logarithm instead. For Gaussian noise:
+
+   log L = beams*log(1/(sqrt(2*pi)*sigma))
+           - (1/(2*sigma^2)) * sum_k (particle_k - robot_k)^2
+
+  A sensor model is a template on the number of beams and a noise
+  model (Likelihood.c). The scale of the error term and the beam
+  angles are compile-time constants of the instantiation, the
+  normalization constant is a constant of it computed once at
+  startup (log() is not constexpr), and the loop over beams has a
+  fixed trip count, so each configuration gets its own fully
+  unrolled kernel. The models built are
+
+   beams      8, 16, 32, 64
+   noise      gaussian - N(0, sigma^2) per beam, what gridSonar()
+                         simulates
+              laplace  - Laplace with the same variance, heavier
+                         tails, so a few bad beams cost less
+
+  with sigma = PF_SONAR_SIGMA, and one is picked at run time with
+  findSensorModel(). Every kernel is vectorized with AVX2/FMA when
+  the CPU has it, SSE2 otherwise (chosen at run time), with a
+  scalar fallback for other architectures. In the compact format
+  (PF_COMPACT, see ParticleStore.h) the AVX2 kernels widen the
+  16-bit readings to doubles as they load them; the others decode
+  each row first.
+
+  Beam k of a 'beams' beam sensor points k*360/(beams+1) degrees
+  from the +y axis of the map, the layout of the original 16 slice
+  sonar (see OccupancyGrid.c).
+
+  Log-likelihoods are turned into normalized beliefs with the
+  log-sum-exp trick (see logNormalize()), which cannot underflow to
+  an all-zero set.
+*/
+
+#ifndef __Likelihood_header
+#define __Likelihood_header
+
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+
+enum noise_model{NOISE_GAUSSIAN, NOISE_LAPLACE};
+
+// Log-likelihood of n particles whose measurements are stored as rows
+// of model->beams in measureD, given the robot readings
+// rob[0..beams-1]. Results go to out[0..n-1].
+typedef void (*likelihood_fn)(const pf_meas *measureD, int n, const double *rob, double *out);
+
+struct sensor_model{
+ int beams;			// Sonar slices
+ enum noise_model noise;
+ double sigma;			// Noise standard deviation in pixels
+ const double *angle;		// Direction of each beam in degrees
+ likelihood_fn batch;		// Kernel for this CPU
+};
+
+// The sensor model with 'beams' beams and the given noise, or NULL
+// if that configuration is not built
+const struct sensor_model *findSensorModel(int beams, enum noise_model noise);
+
+// The i-th sensor model built, or NULL past the last one
+const struct sensor_model *sensorModelAt(int i);
+
+// Log-likelihood of a single particle under 'model'
+double logLikelihood(const struct sensor_model *model, const pf_meas *measureD, const double *rob);
+
+// Noise model from its name ("gaussian", "laplace"), or -1 if unknown
+int noiseModelFromName(const char *name);
+const char *noiseModelName(enum noise_model noise);
+
+// Turn log-likelihoods w[0..n-1] into beliefs that sum to 1, in
+// place: w[i] = exp(w[i]-max) / sum_j exp(w[j]-max). If no weight is
+// finite the set is made uniform.
+void logNormalize(struct thread_pool *pool, double *w, int n);
+
+// Name of the kernel in use ("avx2", "sse2" or "scalar")
+const char *likelihoodKernel(void);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Likelihood-field sensor model. See LikelihoodField.h
+*/
+
+#include "LikelihoodField.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static double noiseDensity(const struct sensor_model *model, double d)
+{
+    double s=model->sigma;
+    if (model->noise==NOISE_LAPLACE) return exp(-M_SQRT2*d/s)/(M_SQRT2*s);
+    return exp(-d*d/(2.0*s*s))/(sqrt(2.0*M_PI)*s);
+}
+
+int buildLikelihoodField(struct likelihood_field *f, const struct occupancy_grid *g, const struct sensor_model *model)
+{
+    memset(f,0,sizeof(struct likelihood_field));
+    f->logp=(float *)malloc((size_t)g->sx*g->sy*sizeof(float));
+    if (f->logp==NULL||gridDistance(g,f->logp)!=0)
+    {
+        freeLikelihoodField(f);
+        return -1;
+    }
+    f->sx=g->sx;
+    f->sy=g->sy;
+
+    // Distances are the same for many pixels, but the table is only
+    // built once
+    double floor_p=(1.0-FIELD_HIT)/PF_SONAR_RANGE;
+    for (size_t i=0; i<(size_t)f->sx*f->sy; i++)
+        f->logp[i]=(float)log(FIELD_HIT*noiseDensity(model,f->logp[i])+floor_p);
+    for (int d=0; d<FIELD_DIST; d++) f->dist[d]=(float)log(FIELD_HIT*noiseDensity(model,d)+floor_p);
+    return 0;
+}
+
+void freeLikelihoodField(struct likelihood_field *f)
+{
+    free(f->logp);
+    memset(f,0,sizeof(struct likelihood_field));
+}
+
+static float offMap(const struct likelihood_field *f, int ex, int ey)
+{
+    // The nearest wall is the first pixel outside the border
+    int ox=(ex<0)?-1-ex:(ex>=f->sx?ex-f->sx:0);
+    int oy=(ey<0)?-1-ey:(ey>=f->sy?ey-f->sy:0);
+    int d=gridRound(sqrt((double)ox*ox+(double)oy*oy));
+    return f->dist[d<FIELD_DIST?d:FIELD_DIST-1];
+}
+
+void fieldLikelihoodBatch(const struct likelihood_field *f, const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y,
+                          int n, const double *rob, double *out)
+{
+    // Endpoint offsets and max-range scores are the same for every
+    // particle
+    double ox[PF_MAX_BEAMS], oy[PF_MAX_BEAMS];
+    float no_wall[PF_MAX_BEAMS];
+    int beams=0;
+    for (int k=0; k<g->beams; k++)
+    {
+        if (rob[k]>=PF_SONAR_RANGE) continue;
+        ox[beams]=g->dx[k]*rob[k];
+        oy[beams]=g->dy[k]*rob[k];
+        no_wall[beams]=f->dist[gridRound(PF_SONAR_RANGE-rob[k])];
+        beams++;
+    }
+
+    for (int i=0; i<n; i++)
+    {
+        double acc=0.0;
+        for (int k=0; k<beams; k++)
+        {
+            int ex=gridRound(x[i]+ox[k]);
+            int ey=gridRound(y[i]+oy[k]);
+            float l;
+            if ((unsigned int)ex<(unsigned int)f->sx&&(unsigned int)ey<(unsigned int)f->sy)
+                l=f->logp[(size_t)ey*f->sx+ex];
+            else
+                l=offMap(f,ex,ey);
+            acc+=(l>no_wall[k])?l:no_wall[k];
+        }
+        out[i]=acc;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Likelihood-field (endpoint) sensor model.
+
+  The beam model (Likelihood.h) compares the robot's readings with
+  what a perfect sonar would read from the particle, so every
+  particle has to ray-cast all of its beams in Step 1, and that is
+  most of the cost of a frame.
+
+  The likelihood field only looks at where each of the robot's
+  readings would end if the robot stood at the particle: beam k of
+  reading z_k ends at
+
+   (x + dx_k*z_k, y + dy_k*z_k)
+
+  and if the particle is right that point is on a wall. The field
+  stores, for every pixel, the log density of an endpoint landing
+  there, a function of the distance d to the nearest wall (see
+  gridDistance()):
+
+   log( FIELD_HIT * p_noise(d) + (1-FIELD_HIT) / PF_SONAR_RANGE )
+
+  where p_noise is the sensor model's noise density (Gaussian or
+  Laplace with sigma = PF_SONAR_SIGMA), and the uniform term keeps
+  one wrong reading from ruling a particle out. A beam that leaves
+  the map stops at its border, so an endpoint off the map is scored
+  by its distance to the border.
+
+  A reading near the sonar range may also be a beam that saw no
+  wall at all (the robot's readings are noisy, so those land on
+  both sides of the range). Each beam therefore scores the better
+  of its endpoint and the density of a max-range beam,
+   max( field(endpoint), log( FIELD_HIT * p_noise(range-z) + floor ) )
+  which only costs a max per lookup, as the second term is the same
+  for every particle. Readings at or beyond the range are skipped.
+
+  Weighting a particle is then one lookup per beam, with no ray
+  casting at all, and particles need no stored readings. The price
+  is accuracy: the field ignores what lies between the particle and
+  the endpoint, so a reading that went through a wall from the
+  particle's pose is not penalized.
+
+  The field is built once per map, 4 bytes per pixel.
+*/
+
+#ifndef __LikelihoodField_header
+#define __LikelihoodField_header
+
+#include "OccupancyGrid.h"
+#include "Likelihood.h"
+
+#define FIELD_HIT 0.9		// Weight of the noise density in the mix
+#define FIELD_DIST 256		// Distances tabulated in 'dist', in pixels
+
+struct likelihood_field{
+ int sx,sy;			// Size of the map in pixels
+ float *logp;			// sx*sy, log density of an endpoint there
+ float dist[FIELD_DIST];	// ... of an endpoint d pixels from a wall
+};
+
+// Build the field for the map in grid 'g' with the noise model of
+// 'model'. Returns 0 on success, -1 if memory runs out.
+int buildLikelihoodField(struct likelihood_field *f, const struct occupancy_grid *g, const struct sensor_model *model);
+
+// Release the field
+void freeLikelihoodField(struct likelihood_field *f);
+
+// Log-likelihood of n particles at (x[i], y[i]) given the robot
+// readings rob[0..g->beams-1] along the grid's beams. Results go to
+// out[0..n-1].
+void fieldLikelihoodBatch(const struct likelihood_field *f, const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y,
+                          int n, const double *rob, double *out);
+
+#endif
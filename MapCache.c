@@ -0,0 +1,243 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Binary map cache. See MapCache.h
+*/
+
+#include "MapCache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MC_ALIGN 64
+
+static const char mc_magic[8]={'P','F','M','A','P','C','\0','\0'};
+
+struct mc_section{
+ uint32_t id;
+ int32_t a,b,c;			// Section parameters (e.g. table size)
+ uint64_t offset;
+ uint64_t size;
+};
+
+struct mc_header{
+ char magic[8];
+ uint32_t version;
+ uint32_t n_sections;
+ uint64_t hash;
+ int32_t sx,sy;
+ struct mc_section section[MC_SECTIONS];
+};
+
+static uint64_t hashBytes(const unsigned char *p, size_t n)
+{
+    // Word-at-a-time multiply/xor-shift hash, fast enough that a warm
+    // start is dominated by the mmap() calls
+    uint64_t h=0x243f6a8885a308d3ULL^(n*0x9e3779b97f4a7c15ULL);
+    size_t i=0;
+    for (; i+8<=n; i+=8)
+    {
+        uint64_t w;
+        memcpy(&w,p+i,8);
+        h=(h^w)*0x9e3779b97f4a7c15ULL;
+        h^=h>>29;
+    }
+    uint64_t w=0;
+    memcpy(&w,p+i,n-i);
+    h=(h^w)*0x9e3779b97f4a7c15ULL;
+    h^=h>>32;
+    return h;
+}
+
+static void *mapFile(const char *path, size_t *size)
+{
+    int fd=open(path,O_RDONLY);
+    if (fd<0) return NULL;
+
+    struct stat st;
+    void *p=NULL;
+    if (fstat(fd,&st)==0&&st.st_size>0)
+    {
+        p=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+        if (p==MAP_FAILED) p=NULL;
+        else *size=(size_t)st.st_size;
+    }
+    close(fd);
+    return p;
+}
+
+int hashFile(const char *path, uint64_t *hash)
+{
+    size_t size;
+    void *p=mapFile(path,&size);
+    if (p==NULL) return -1;
+    *hash=hashBytes((const unsigned char *)p,size);
+    munmap(p,size);
+    return 0;
+}
+
+static void cachePath(char *path, size_t len, const char *dir, uint64_t hash)
+{
+    snprintf(path,len,"%s/%016llx.pfmap",dir,(unsigned long long)hash);
+}
+
+static const struct mc_section *findSection(const struct map_cache *c, enum map_cache_section id)
+{
+    const struct mc_header *h=(const struct mc_header *)c->base;
+    if (h==NULL) return NULL;
+    for (uint32_t i=0; i<h->n_sections; i++)
+        if (h->section[i].id==(uint32_t)id) return &h->section[i];
+    return NULL;
+}
+
+int openMapCache(struct map_cache *c, const char *dir, const char *ppm)
+{
+    char path[4096];
+
+    memset(c,0,sizeof(struct map_cache));
+    if (hashFile(ppm,&c->hash)!=0) return -1;
+
+    cachePath(path,sizeof(path),dir,c->hash);
+    c->base=mapFile(path,&c->size);
+    if (c->base==NULL) return -1;
+
+    // Validate everything before trusting any offset
+    const struct mc_header *h=(const struct mc_header *)c->base;
+    int ok=c->size>=sizeof(struct mc_header)&&!memcmp(h->magic,mc_magic,sizeof(mc_magic))&&
+           h->version==MC_VERSION&&h->hash==c->hash&&h->n_sections<=MC_SECTIONS&&h->sx>0&&h->sy>0;
+    for (uint32_t i=0; ok&&i<h->n_sections; i++)
+    {
+        const struct mc_section *s=&h->section[i];
+        ok=s->offset%MC_ALIGN==0&&s->offset<=c->size&&s->size<=c->size-s->offset;
+    }
+    if (!ok)
+    {
+        closeMapCache(c);
+        return -1;
+    }
+    c->sx=h->sx;
+    c->sy=h->sy;
+    return 0;
+}
+
+void closeMapCache(struct map_cache *c)
+{
+    uint64_t hash=c->hash;
+    if (c->base!=NULL) munmap(c->base,c->size);
+    memset(c,0,sizeof(struct map_cache));
+    c->hash=hash;
+}
+
+int mapCacheOwns(const struct map_cache *c, const void *p)
+{
+    const char *b=(const char *)c->base;
+    return b!=NULL&&(const char *)p>=b&&(const char *)p<b+c->size;
+}
+
+const unsigned char *mapCacheImage(const struct map_cache *c)
+{
+    const struct mc_section *s=findSection(c,MC_IMAGE);
+    if (s==NULL||s->size!=(uint64_t)c->sx*c->sy*3) return NULL;
+    return (const unsigned char *)c->base+s->offset;
+}
+
+int mapCacheGrid(const struct map_cache *c, struct occupancy_grid *g)
+{
+    const struct mc_section *s=findSection(c,MC_GRID);
+    const struct mc_section *k=findSection(c,MC_SKIP);
+    if (s==NULL||s->size!=(uint64_t)((c->sx+7)/8)*((c->sy+7)/8)*sizeof(uint64_t)) return -1;
+    if (k==NULL||k->size!=(uint64_t)c->sx*c->sy) return -1;
+
+    // Sections start MC_ALIGN aligned and are zero padded to a
+    // multiple of it, which is the step table's layout in memory
+    static_assert(MC_ALIGN%GRID_SKIP_ALIGN==0,"The cache must align the step table as buildSkip() does");
+    if (c->size-k->offset<gridSkipBytes(c->sx,c->sy)) return -1;
+    gridFromTiles(g,(const uint64_t *)((const char *)c->base+s->offset),(const unsigned char *)c->base+k->offset,c->sx,c->sy);
+    return 0;
+}
+
+int mapCacheFreeSpace(const struct map_cache *c, struct free_space *f)
+{
+    const struct mc_section *s=findSection(c,MC_FREE);
+    if (s==NULL||s->a<=0||s->size!=(uint64_t)s->a*sizeof(unsigned int)) return -1;
+    f->sx=c->sx;
+    f->sy=c->sy;
+    f->n=s->a;
+    f->cell=(unsigned int *)((const char *)c->base+s->offset);
+    return 0;
+}
+
+int mapCacheRayTable(const struct map_cache *c, struct ray_table *t, size_t budget)
+{
+    const struct mc_section *s=findSection(c,MC_RAYS);
+    if (s==NULL||s->size>budget||s->size!=(uint64_t)s->b*s->c*PF_BEAMS) return -1;
+    memset(t,0,sizeof(struct ray_table));
+    t->sx=c->sx;
+    t->sy=c->sy;
+    t->stride=s->a;
+    t->tx=s->b;
+    t->ty=s->c;
+    t->dist=(unsigned char *)((const char *)c->base+s->offset);
+    return 0;
+}
+
+static int writeSection(FILE *f, struct mc_header *h, enum map_cache_section id, const void *data, size_t size,
+                        int a, int b, int c, uint64_t *offset)
+{
+    static const char zero[MC_ALIGN]={0};
+    struct mc_section *s=&h->section[h->n_sections++];
+
+    s->id=id;
+    s->a=a;
+    s->b=b;
+    s->c=c;
+    s->offset=*offset;
+    s->size=size;
+    if (fwrite(data,1,size,f)!=size) return -1;
+    *offset+=size;
+    size_t pad=(MC_ALIGN-*offset%MC_ALIGN)%MC_ALIGN;
+    if (fwrite(zero,1,pad,f)!=pad) return -1;
+    *offset+=pad;
+    return 0;
+}
+
+int writeMapCache(const char *dir, uint64_t hash, const unsigned char *map, int sx, int sy,
+                  const struct occupancy_grid *g, const struct free_space *fs, const struct ray_table *t)
+{
+    char path[4096], tmp[4200];
+    struct mc_header h;
+    uint64_t offset=(sizeof(struct mc_header)+MC_ALIGN-1)/MC_ALIGN*MC_ALIGN;
+
+    cachePath(path,sizeof(path),dir,hash);
+    snprintf(tmp,sizeof(tmp),"%s.%d.tmp",path,(int)getpid());
+    FILE *f=fopen(tmp,"wb");
+    if (f==NULL) return -1;
+
+    // Sections go after room for the header, which is written last
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,mc_magic,sizeof(mc_magic));
+    h.version=MC_VERSION;
+    h.hash=hash;
+    h.sx=sx;
+    h.sy=sy;
+    int err=fseek(f,(long)offset,SEEK_SET)!=0;
+    if (!err) err=writeSection(f,&h,MC_IMAGE,map,(size_t)sx*sy*3,0,0,0,&offset);
+    if (!err) err=writeSection(f,&h,MC_GRID,g->tile,(size_t)g->tx*g->ty*sizeof(uint64_t),0,0,0,&offset);
+    if (!err) err=writeSection(f,&h,MC_SKIP,g->skip,(size_t)sx*sy,0,0,0,&offset);
+    if (!err) err=writeSection(f,&h,MC_FREE,fs->cell,(size_t)fs->n*sizeof(unsigned int),fs->n,0,0,&offset);
+    if (!err&&t!=NULL&&t->dist!=NULL)
+        err=writeSection(f,&h,MC_RAYS,t->dist,(size_t)t->tx*t->ty*PF_BEAMS,t->stride,t->tx,t->ty,&offset);
+    if (!err) err=fseek(f,0,SEEK_SET)!=0||fwrite(&h,sizeof(h),1,f)!=1;
+    if (fclose(f)!=0) err=1;
+
+    if (err||rename(tmp,path)!=0)
+    {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Binary map cache.
+
+  readPPMimage() parses the map through stdio on every launch, and
+  the occupancy grid, the free-space index and the ray-cast table
+  are then rebuilt from it. The cache keeps all of them in one
+  binary file per map, laid out exactly as they are used in memory,
+  so a warm start is: hash the .ppm, mmap() the cache read-only and
+  point the structures at it. Nothing is parsed or copied, and
+  every process using the same map (e.g. the trial runner's, or
+  several runs side by side) shares the same physical pages.
+
+  Cache files are named <dir>/<hash>.pfmap, where <hash> is a 64-bit
+  hash of the .ppm file's contents, so an edited map simply misses
+  the cache. The file starts with a header (magic, format version,
+  hash, map size) and a table of sections:
+
+   MC_IMAGE  - the RGB image, for display
+   MC_GRID   - occupancy grid tiles (see OccupancyGrid.h)
+   MC_SKIP   - the grid's distance transform step table
+   MC_FREE   - free-space index (see FreeSpace.h)
+   MC_RAYS   - ray-cast table (see RayTable.h), if one was built
+
+  Each section is 64-byte aligned and zero padded to a multiple of
+  64 bytes, so a table read in whole words (the step table, see
+  gridSkipBytes()) stays inside the file. A file with a different
+  version, a different hash or a section that does not fit the file
+  is ignored and rewritten. Files are written to a temporary name and
+  renamed into place, so a process never maps a half-written cache.
+
+  Structures filled from the cache borrow its memory: they must not
+  be freed with their usual functions while the cache is open, see
+  mapCacheOwns().
+*/
+
+#ifndef __MapCache_header
+#define __MapCache_header
+
+#include <stdint.h>
+#include <stddef.h>
+#include "OccupancyGrid.h"
+#include "FreeSpace.h"
+#include "RayTable.h"
+
+#define MC_VERSION 2
+
+enum map_cache_section{
+ MC_IMAGE,
+ MC_GRID,
+ MC_SKIP,
+ MC_FREE,
+ MC_RAYS,
+ MC_SECTIONS
+};
+
+struct map_cache{
+ void *base;			// mmap()ed file, NULL if not open
+ size_t size;
+ uint64_t hash;			// Hash of the .ppm
+ int sx,sy;
+};
+
+// 64-bit hash of a file's contents. Returns 0 on success, -1 if the
+// file can't be read.
+int hashFile(const char *path, uint64_t *hash);
+
+// Open the cache for map 'ppm' in directory 'dir'. Returns 0 if a
+// valid cache was mapped, -1 otherwise (c->hash is still set when
+// the map itself could be read, for writeMapCache()).
+int openMapCache(struct map_cache *c, const char *dir, const char *ppm);
+
+// Unmap the cache
+void closeMapCache(struct map_cache *c);
+
+// Point the structures at the cached data. Each returns 0 on
+// success, -1 if the section is missing. mapCacheRayTable() only
+// succeeds if the cached table fits in 'budget' bytes.
+const unsigned char *mapCacheImage(const struct map_cache *c);
+int mapCacheGrid(const struct map_cache *c, struct occupancy_grid *g);
+int mapCacheFreeSpace(const struct map_cache *c, struct free_space *f);
+int mapCacheRayTable(const struct map_cache *c, struct ray_table *t, size_t budget);
+
+// True if p points into the mapped cache (memory that must not be
+// freed)
+int mapCacheOwns(const struct map_cache *c, const void *p);
+
+// Write the cache for a map with hash 'hash'. 't' may be NULL or an
+// empty table. Returns 0 on success, -1 on I/O errors.
+int writeMapCache(const char *dir, uint64_t hash, const unsigned char *map, int sx, int sy,
+                  const struct occupancy_grid *g, const struct free_space *f, const struct ray_table *t);
+
+#endif
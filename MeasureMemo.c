@@ -0,0 +1,106 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Per-frame memo of ground truth readings. See MeasureMemo.h
+*/
+
+#include "MeasureMemo.h"
+
+#define MEMO_MAX_PROBE 16	// Give up on a cell after this many slots
+
+int initMemo(struct measure_memo *m, double quantum, int n_workers, int cap)
+{
+    memset(m,0,sizeof(struct measure_memo));
+    if (quantum<=0.0||n_workers<1||cap<1) return -1;
+
+    // Keep tables at most half full
+    unsigned int size=64;
+    while (size<2u*(unsigned int)cap) size<<=1;
+
+    m->table=(struct memo_table *)calloc(n_workers,sizeof(struct memo_table));
+    if (m->table==NULL) return -1;
+    m->n_tables=n_workers;
+    for (int w=0; w<n_workers; w++)
+    {
+        m->table[w].entry=(struct memo_entry *)calloc(size,sizeof(struct memo_entry));
+        if (m->table[w].entry==NULL)
+        {
+            freeMemo(m);
+            return -1;
+        }
+        m->table[w].mask=size-1;
+    }
+    m->quantum=quantum;
+    m->inv=1.0/quantum;
+    m->stamp=1;
+    m->enabled=1;
+    return 0;
+}
+
+void freeMemo(struct measure_memo *m)
+{
+    for (int w=0; w<m->n_tables; w++) free(m->table[w].entry);
+    free(m->table);
+    memset(m,0,sizeof(struct measure_memo));
+}
+
+void memoNewFrame(struct measure_memo *m)
+{
+    // A new stamp marks every entry empty
+    if (++m->stamp==0)
+    {
+        for (int w=0; w<m->n_tables; w++)
+            memset(m->table[w].entry,0,((size_t)m->table[w].mask+1)*sizeof(struct memo_entry));
+        m->stamp=1;
+    }
+}
+
+void memoGroundTruth(struct measure_memo *m, const struct occupancy_grid *g, int worker, double x, double y, double *d)
+{
+    struct memo_table *t=&m->table[worker];
+    int32_t cx=(int32_t)floor(x*m->inv+0.5);
+    int32_t cy=(int32_t)floor(y*m->inv+0.5);
+    uint32_t h=((uint32_t)cx*0x9E3779B1u)^((uint32_t)cy*0x85EBCA77u);
+    h^=h>>15;
+
+    t->lookups++;
+    struct memo_entry *free_slot=NULL;
+    for (int probe=0; probe<MEMO_MAX_PROBE; probe++)
+    {
+        struct memo_entry *e=&t->entry[(h+probe)&t->mask];
+        if (e->stamp!=m->stamp)
+        {
+            free_slot=e;
+            break;
+        }
+        if (e->cx==cx&&e->cy==cy)
+        {
+            t->hits++;
+            for (int k=0; k<PF_BEAMS; k++) d[k]=e->d[k];
+            return;
+        }
+    }
+
+    // Ray-cast the cell's centre, so the readings don't depend on
+    // which particle got here first
+    gridCast(g,cx*m->quantum,cy*m->quantum,d);
+    if (free_slot!=NULL)
+    {
+        free_slot->stamp=m->stamp;
+        free_slot->cx=cx;
+        free_slot->cy=cy;
+        for (int k=0; k<PF_BEAMS; k++) free_slot->d[k]=(unsigned char)d[k];
+    }
+}
+
+double memoHitRate(const struct measure_memo *m, long *lookups)
+{
+    long n=0, hits=0;
+    for (int w=0; w<m->n_tables; w++)
+    {
+        n+=m->table[w].lookups;
+        hits+=m->table[w].hits;
+    }
+    if (lookups!=NULL) *lookups=n;
+    return n>0?(double)hits/n:0.0;
+}
@@ -0,0 +1,82 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Per-frame memo of ground truth readings.
+
+  After resampling, many particles are copies of the same parent and
+  differ only by the motion noise added in Step 1, so once the cloud
+  has converged most of them sit within a fraction of a pixel of
+  each other, and Step 1 ray-casts the same spot over and over.
+
+  The memo divides the map into square cells 'quantum' pixels wide
+  and ray-casts each cell at most once per frame, at the cell's
+  centre; every particle in the cell gets those readings. The key
+  is (x, y) only: ground_truth() does not depend on the heading.
+  Like the ray-cast table (RayTable.h) this is an approximation,
+  readings are those of a point up to quantum/sqrt(2) pixels away,
+  so keep the quantum small. Because a cell's readings do not
+  depend on which particle got there first, the results are still
+  the same for any number of threads.
+
+  Each pool worker has its own open-addressing hash table, so no
+  locking is needed. Resampling writes copies of a parent next to
+  each other, so they end up in the same chunk and the same
+  worker's table. Tables are generation-stamped: starting a new
+  frame is O(1). A table that fills up just stops memoizing for
+  the rest of the frame.
+
+  Lookups and hits are counted per worker, see memoHitRate().
+
+  Entries hold PF_BEAMS readings, so the memo only works with the
+  default 16 beam sensor.
+*/
+
+#ifndef __MeasureMemo_header
+#define __MeasureMemo_header
+
+#include <stdint.h>
+#include "OccupancyGrid.h"
+
+struct memo_entry{
+ uint32_t stamp;		// Frame that filled the entry
+ int32_t cx,cy;			// Cell
+ unsigned char d[PF_BEAMS];	// Readings (whole pixels, at most 150)
+};
+
+struct memo_table{
+ struct memo_entry *entry;
+ unsigned int mask;		// Capacity - 1 (a power of two)
+ long lookups, hits;		// Since the memo was set up
+ char pad[64];			// Keep workers' counters apart
+};
+
+struct measure_memo{
+ int enabled;
+ double quantum;		// Cell size in pixels
+ double inv;			// 1/quantum
+ int n_tables;			// One per pool worker
+ struct memo_table *table;
+ uint32_t stamp;		// Current frame
+};
+
+// Set up a memo with 'quantum' pixel cells for 'n_workers' workers,
+// each able to hold 'cap' cells per frame. Returns 0 on success, -1
+// if the parameters are invalid or memory runs out.
+int initMemo(struct measure_memo *m, double quantum, int n_workers, int cap);
+
+// Release the memo
+void freeMemo(struct measure_memo *m);
+
+// Forget the previous frame's readings (particles have moved)
+void memoNewFrame(struct measure_memo *m);
+
+// Fill d[0..PF_BEAMS-1] with the readings for the cell of (x,y),
+// ray-casting on grid 'g' if this worker has not seen the cell this
+// frame
+void memoGroundTruth(struct measure_memo *m, const struct occupancy_grid *g, int worker, double x, double y, double *d);
+
+// Fraction of lookups answered from the memo so far, and the number
+// of lookups in 'lookups' (if not NULL)
+double memoHitRate(const struct measure_memo *m, long *lookups);
+
+#endif
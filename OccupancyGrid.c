@@ -0,0 +1,271 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Bit-packed occupancy grid. See OccupancyGrid.h
+*/
+
+#include "OccupancyGrid.h"
+#include "ParticleMotion.h"
+
+// Constants used by the ParticleUtils ray caster. Its value of pi is
+// slightly off, and the beams are 360/17 degrees apart (so 16 beams
+// do not quite cover the circle). Both are kept so the readings
+// match bit for bit.
+#define GT_PI 0x1.921fb5442771cp+1	// 3.14159265354
+#define GT_BEAM_STEP (360.0/17.0)
+#define GT_RANGE PF_SONAR_RANGE
+#define ROBOT_CLEARANCE 15.0		// initRobot() minimum reading
+#define SKIP_MARGIN 1.415		// > sqrt(2), rounding error of two samples
+
+void gridSetBeams(struct occupancy_grid *g, int beams, const double *angle)
+{
+    // Beam directions, computed exactly as ground_truth() does
+    g->beams=beams;
+    for (int k=0; k<beams; k++)
+    {
+        double a=(angle!=NULL)?angle[k]:k*GT_BEAM_STEP;
+        a=((a+a)*GT_PI)/360.0;
+        double s=-sin(a), c=cos(a);
+        double len=sqrt(c*c+s*s);
+        g->dx[k]=s/len;
+        g->dy[k]=c/len;
+    }
+}
+
+static void rowTransform(const double *f, int n, double *d, int *v, double *z)
+{
+    // 1D squared distance transform d[q] = min_p (q-p)^2 + f[p]
+    // (lower envelope of parabolas, Felzenszwalb & Huttenlocher)
+    int k=0;
+    v[0]=0;
+    z[0]=-HUGE_VAL;
+    z[1]=HUGE_VAL;
+    for (int q=1; q<n; q++)
+    {
+        if (f[q]>=HUGE_VAL) continue;
+        if (f[v[k]]>=HUGE_VAL)
+        {
+            v[k]=q;
+            continue;
+        }
+        double s=((f[q]+(double)q*q)-(f[v[k]]+(double)v[k]*v[k]))/(2.0*(q-v[k]));
+        while (s<=z[k])
+        {
+            k--;
+            s=((f[q]+(double)q*q)-(f[v[k]]+(double)v[k]*v[k]))/(2.0*(q-v[k]));
+        }
+        k++;
+        v[k]=q;
+        z[k]=s;
+        z[k+1]=HUGE_VAL;
+    }
+    k=0;
+    for (int q=0; q<n; q++)
+    {
+        while (z[k+1]<q) k++;
+        d[q]=(f[v[k]]>=HUGE_VAL)?HUGE_VAL:(double)(q-v[k])*(q-v[k])+f[v[k]];
+    }
+}
+
+static int wallDistance2(const struct occupancy_grid *g, double *d2)
+{
+    // Squared distance from each pixel to the nearest wall or pixel
+    // outside the map, into d2[sx*sy]
+    int sx=g->sx, sy=g->sy, n=(sx>sy)?sx:sy;
+    double *f=(double *)calloc(n,sizeof(double));	// Zeroed only to keep -Wmaybe-uninitialized quiet
+    double *d=(double *)malloc(n*sizeof(double));
+    double *z=(double *)malloc((n+1)*sizeof(double));
+    int *v=(int *)malloc(n*sizeof(int));
+    if (f==NULL||d==NULL||z==NULL||v==NULL)
+    {
+        free(f);
+        free(d);
+        free(z);
+        free(v);
+        return -1;
+    }
+
+    // Along each column, then along each row
+    for (int x=0; x<sx; x++)
+    {
+        for (int y=0; y<sy; y++) f[y]=gridOccupied(g,x,y)?0.0:HUGE_VAL;
+        rowTransform(f,sy,d,v,z);
+        for (int y=0; y<sy; y++) d2[(size_t)y*sx+x]=d[y];
+    }
+    for (int y=0; y<sy; y++)
+    {
+        double *row=d2+(size_t)y*sx;
+        rowTransform(row,sx,d,v,z);
+        for (int x=0; x<sx; x++)
+        {
+            // Pixels outside the map stop a beam too, the nearest one
+            // is straight across the border
+            int b=x+1;
+            if (sx-x<b) b=sx-x;
+            if (y+1<b) b=y+1;
+            if (sy-y<b) b=sy-y;
+            row[x]=d[x]<(double)b*b?d[x]:(double)b*b;
+        }
+    }
+    free(f);
+    free(d);
+    free(z);
+    free(v);
+    return 0;
+}
+
+static int buildSkip(struct occupancy_grid *g)
+{
+    int sx=g->sx, sy=g->sy;
+    double *d2=(double *)malloc((size_t)sx*sy*sizeof(double));
+    size_t bytes=gridSkipBytes(sx,sy);
+    g->skip=(unsigned char *)aligned_alloc(GRID_SKIP_ALIGN,bytes);
+    if (d2==NULL||g->skip==NULL||wallDistance2(g,d2)!=0)
+    {
+        free(d2);
+        return -1;
+    }
+    memset(g->skip+(size_t)sx*sy,0,bytes-(size_t)sx*sy);
+
+    for (size_t i=0; i<(size_t)sx*sy; i++)
+    {
+        if (d2[i]==0.0)
+        {
+            g->skip[i]=GRID_WALL;
+            continue;
+        }
+        double steps=floor(sqrt(d2[i])-SKIP_MARGIN);
+        g->skip[i]=(unsigned char)(steps<0.0?0:(steps>GRID_WALL-1?GRID_WALL-1:steps));
+    }
+    free(d2);
+    return 0;
+}
+
+int gridDistance(const struct occupancy_grid *g, float *dist)
+{
+    double *d2=(double *)malloc((size_t)g->sx*g->sy*sizeof(double));
+    if (d2==NULL||wallDistance2(g,d2)!=0)
+    {
+        free(d2);
+        return -1;
+    }
+    for (size_t i=0; i<(size_t)g->sx*g->sy; i++) dist[i]=(float)sqrt(d2[i]);
+    free(d2);
+    return 0;
+}
+
+int buildOccupancyGrid(struct occupancy_grid *g, const unsigned char *map, int sx, int sy)
+{
+    memset(g,0,sizeof(struct occupancy_grid));
+    g->tx=(sx+7)/8;
+    g->ty=(sy+7)/8;
+    g->tile=(uint64_t *)calloc((size_t)g->tx*g->ty,sizeof(uint64_t));
+    if (g->tile==NULL) return -1;
+    g->sx=sx;
+    g->sy=sy;
+
+    for (int y=0; y<sy; y++)
+    {
+        const unsigned char *row=map+(size_t)y*sx*3;
+        for (int x=0; x<sx; x++)
+            if (row[3*x]|row[3*x+1]|row[3*x+2])
+                g->tile[(size_t)(y>>3)*g->tx+(x>>3)]|=(uint64_t)1<<(((y&7)<<3)|(x&7));
+    }
+    if (buildSkip(g)!=0)
+    {
+        freeOccupancyGrid(g);
+        return -1;
+    }
+    gridSetBeams(g,PF_BEAMS,NULL);
+    return 0;
+}
+
+void gridFromTiles(struct occupancy_grid *g, const uint64_t *tile, const unsigned char *skip, int sx, int sy)
+{
+    memset(g,0,sizeof(struct occupancy_grid));
+    g->sx=sx;
+    g->sy=sy;
+    g->tx=(sx+7)/8;
+    g->ty=(sy+7)/8;
+    g->tile=(uint64_t *)tile;
+    g->skip=(unsigned char *)skip;
+    gridSetBeams(g,PF_BEAMS,NULL);
+}
+
+void freeOccupancyGrid(struct occupancy_grid *g)
+{
+    free(g->tile);
+    free(g->skip);
+    memset(g,0,sizeof(struct occupancy_grid));
+}
+
+void gridCast(const struct occupancy_grid *g, double x0, double y0, double *out)
+{
+    // Steps that can be skipped from the starting pixel
+    int x=gridRound(x0), y=gridRound(y0);
+    int skip0=(x<0||x>=g->sx||y<0||y>=g->sy)?0:g->skip[(size_t)y*g->sx+x];
+    if (skip0==GRID_WALL) skip0=0;
+
+    for (int k=0; k<g->beams; k++)
+    {
+        // March one pixel at a time until the beam leaves the map,
+        // reaches a wall, or runs out of range. The reading is the
+        // step at which it stopped. Steps the distance transform says
+        // are free are jumped over (see OccupancyGrid.h).
+        double dx=g->dx[k], dy=g->dy[k];
+        double d=0.0;
+        int skip=skip0;
+        while (1)
+        {
+            d+=skip;
+            if (d>=GT_RANGE)
+            {
+                d=GT_RANGE;
+                break;
+            }
+            d+=1.0;
+            x=gridRound(dx*d+x0);
+            y=gridRound(dy*d+y0);
+            if (x<0||x>=g->sx||y<0||y>=g->sy) break;
+            skip=g->skip[(size_t)y*g->sx+x];
+            if (skip==GRID_WALL||d>=GT_RANGE) break;
+        }
+        out[k]=d;
+    }
+}
+
+void gridSonar(const struct occupancy_grid *g, const struct particle *p, double *d, struct rng_stream *rng)
+{
+    gridCast(g,p->x,p->y,d);
+    for (int k=0; k<g->beams; k++)
+    {
+        double m=d[k]+GaussianNoiseR(0.0,PF_SONAR_SIGMA,rng);
+        d[k]=(m<0.0)?0.0:m;
+    }
+}
+
+struct particle *gridInitRobot(const struct occupancy_grid *g, struct rng_stream *rng)
+{
+    double d[PF_MAX_BEAMS];
+    struct particle *robot=(struct particle *)calloc(1,sizeof(struct particle));
+    if (robot==NULL) return NULL;
+    robot->prob=1.0;
+    robot->next=NULL;
+
+    while (1)
+    {
+        int x=(int)floor(rngUniform(rng)*g->sx);
+        int y=(int)floor(rngUniform(rng)*g->sy);
+        if (x<0||y<0||x>=g->sx||y>=g->sy) continue;
+
+        robot->x=x;
+        robot->y=y;
+        gridCast(g,robot->x,robot->y,d);
+        int clear=1;
+        for (int k=0; k<g->beams; k++)
+            if (d[k]<ROBOT_CLEARANCE) clear=0;
+        if (!gridOccupied(g,x,y)&&clear) break;
+    }
+    robot->theta=round(rngUniform(rng)*360.0);
+    return robot;
+}
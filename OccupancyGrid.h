@@ -0,0 +1,148 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Bit-packed occupancy grid.
+
+  Collision tests and ray casting only ask one question of the map:
+  is this pixel black (free) or not? The RGB image answers it from
+  3 bytes per pixel, 3 MB for the 1024x1024 maze, so every ray
+  step and every hit() test reaches into a buffer far bigger than
+  the L2 cache.
+
+  The grid stores one bit per pixel (1 = wall), 128 KB for the
+  maze. Pixels are grouped into 8x8 tiles, each tile one 64-bit
+  word, so a ray heading in any direction stays within a few
+  words; with plain rows a ray going up or down would touch a new
+  cache line on every step.
+
+  The functions below are drop-in replacements for the ParticleUtils
+  ones that read the map, reproducing their results exactly (same
+  rounding, same beam directions, same stopping rules). Where random
+  numbers are used they follow the same procedure, but draw from the
+  caller's random stream (see RandomStream.h) instead of drand48():
+
+   gridHit()          - hit()
+   gridGroundTruth()  - ground_truth()
+   gridSonar()        - sonar_measurement()
+   gridInitRobot()    - initRobot()
+
+  The RGB image is then only needed for display.
+
+  The grid also holds the beam directions of the sensor in use.
+  They default to the 16 slices of ground_truth(); gridSetBeams()
+  switches them to another sensor model's (see Likelihood.h), and
+  gridCast() then returns that many readings.
+
+  Ray casting marches one pixel per step, so in open areas a beam
+  takes up to 150 steps. The grid also keeps a Euclidean distance
+  transform of the walls (the map border counts as a wall), stored
+  as the number of steps a beam can safely skip from each pixel:
+  a rounded sample is at most sqrt(2)/2 from the true point on the
+  beam, so from a pixel at distance D from the nearest wall the
+  next floor(D-1.415) samples cannot land on a wall. The march
+  jumps over those (sphere tracing) and only tests the samples
+  near walls, giving the same readings in far fewer steps.
+*/
+
+#ifndef __OccupancyGrid_header
+#define __OccupancyGrid_header
+
+#include "ParticleStore.h"
+#include "RandomStream.h"
+#include <stdint.h>
+
+#define GRID_WALL 255		// Step table entry of a wall pixel
+#define GRID_SKIP_ALIGN 64	// Alignment and size granule of the step table
+
+struct occupancy_grid{
+ int sx,sy;			// Size of the map in pixels
+ int tx,ty;			// Size of the grid in 8x8 tiles
+ uint64_t *tile;		// tx*ty tiles, bit (y%8)*8+(x%8) set for walls
+ unsigned char *skip;		// sx*sy, beam steps that are safe to skip
+				// from each pixel, or GRID_WALL (padded,
+				// see gridSkipBytes())
+ int beams;			// Sonar beams cast by gridCast()
+ double dx[PF_MAX_BEAMS];	// Unit direction of each sonar beam
+ double dy[PF_MAX_BEAMS];
+};
+
+// Build the grid for an sx x sy RGB map (anything not black is a
+// wall). Returns 0 on success, -1 if memory runs out.
+int buildOccupancyGrid(struct occupancy_grid *g, const unsigned char *map, int sx, int sy);
+
+// Bytes held for the step table of an sx x sy map: sx*sy rounded up
+// to GRID_SKIP_ALIGN, with the table starting GRID_SKIP_ALIGN
+// aligned. gridCastBatch() reads it as whole 32-bit words, so the
+// word holding the last entry must be there too.
+static inline size_t gridSkipBytes(int sx, int sy)
+{
+ return ((size_t)sx*sy+GRID_SKIP_ALIGN-1)/GRID_SKIP_ALIGN*GRID_SKIP_ALIGN;
+}
+
+// Set up a grid over existing tiles and step table (e.g. from the
+// map cache). Both are borrowed, not copied: don't
+// freeOccupancyGrid() it. The step table must be laid out as
+// gridSkipBytes() says.
+void gridFromTiles(struct occupancy_grid *g, const uint64_t *tile, const unsigned char *skip, int sx, int sy);
+
+// Release the grid
+void freeOccupancyGrid(struct occupancy_grid *g);
+
+// Euclidean distance from each pixel to the nearest wall, or to the
+// nearest pixel outside the map if that is closer, into
+// dist[0..sx*sy-1] (0 on walls). Returns 0 on success, -1 if memory
+// runs out.
+int gridDistance(const struct occupancy_grid *g, float *dist);
+
+// Cast 'beams' beams (at most PF_MAX_BEAMS) in the directions
+// angle[0..beams-1], in degrees, from now on
+void gridSetBeams(struct occupancy_grid *g, int beams, const double *angle);
+
+// Wall test for a pixel inside the map
+static inline int gridOccupied(const struct occupancy_grid *g, int x, int y)
+{
+ uint64_t t=g->tile[(size_t)(y>>3)*g->tx+(x>>3)];
+ return (int)((t>>(((y&7)<<3)|(x&7)))&1);
+}
+
+// (int)round(v) for |v| < 2^31, without the libm call
+static inline int gridRound(double v)
+{
+ int i=(int)v;
+ double f=v-i;			// Exact
+ return i+(f>=0.5)-(f<=-0.5);
+}
+
+// Same as hit(p,map,sx,sy): 1 if the particle is on a wall. The
+// position is rounded and clamped to the map.
+static inline int gridHit(const struct occupancy_grid *g, const struct particle *p)
+{
+ int x=gridRound(p->x);
+ int y=gridRound(p->y);
+ x=x<0?0:(x>=g->sx?g->sx-1:x);
+ y=y<0?0:(y>=g->sy?g->sy-1:y);
+ return gridOccupied(g,x,y);
+}
+
+// Ground truth readings from (x,y) for each of the grid's beams,
+// into d[0..g->beams-1]
+void gridCast(const struct occupancy_grid *g, double x, double y, double *d);
+
+// Same as ground_truth(p,map,sx,sy): fills p->measureD. Only for
+// grids with the default PF_BEAMS beams.
+static inline void gridGroundTruth(const struct occupancy_grid *g, struct particle *p)
+{
+ gridCast(g,p->x,p->y,p->measureD);
+}
+
+// Same as sonar_measurement(p,map,sx,sy): ground truth plus noise
+// drawn from 'rng', for each of the grid's beams into d[0..g->beams-1]
+void gridSonar(const struct occupancy_grid *g, const struct particle *p, double *d, struct rng_stream *rng);
+
+// Same as initRobot(map,sx,sy): a new robot at a random free
+// location with at least 15 pixels of clearance on every beam,
+// drawn from 'rng'. Release it with deleteList(). Returns NULL if
+// out of memory.
+struct particle *gridInitRobot(const struct occupancy_grid *g, struct rng_stream *rng);
+
+#endif
@@ -0,0 +1,691 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Per-kernel micro-benchmarks for the particle filter.
+
+  Usage (see bench.sh, which builds and runs this program):
+
+   ParticleBench [--reps R] [--warmup W] [--out file.csv]
+                 [--sizes n1,n2,...] [map.ppm ...]
+
+  Every kernel is timed on every map at every particle count. Each
+  measurement is one full pass of the kernel over the particle set
+  (or one call, for the set-wide stages), repeated W times to warm
+  up and then R times for the statistics. Kernels run on a single
+  thread so the numbers measure the code, not the machine's core
+  count.
+
+  A table goes to stdout, and one CSV row per (kernel, map, count)
+  to the output file:
+
+   kernel,map,particles,reps,median_ms,p99_ms,min_ms,ns_per_particle
+
+  Compare the files from two builds to spot regressions.
+
+  The naive resampler is O(N^2) and is only run up to 10000
+  particles.
+
+  The filter runs with the default 16 beam Gaussian sensor model.
+  The likelihood kernel of every other sensor model (Likelihood.h)
+  is timed too, as likelihood_<beams>_<noise>, on readings cast
+  from the same particle set with that model's beams. The
+  likelihood field (LikelihoodField.h) is timed as likelihood_field,
+  and as step1_field, Step 1 without the ray casting it makes
+  unnecessary.
+
+  Ray casting is timed one particle at a time (gridCast) and in
+  batches (gridCastBatch, see RayBatch.h). The batched readings of
+  every sensor model's beams are also checked against gridCast();
+  any difference is reported as FAIL and the program exits with
+  status 1.
+
+  Steps 1 and 3 are timed both as the filter loop runs them, fused
+  into one pass over blocks of particles that also builds the frame
+  estimate (step13_fused, see FrameEstimate.h), and as the separate
+  passes they replace: move, likelihoods, normalization,
+  isCentralized() and the scan for the best particle
+  (step13_separate), also with the likelihood field
+  (step13_field_*), where the passes are a larger share. The fused
+  estimate and beliefs are checked against the separate passes,
+  with FAIL and exit status 1 if they disagree.
+
+  The pose clusters (findClusters, see PoseClusters.h) are timed on
+  the beliefs of the first frame, when the set still covers the
+  whole map and the histogram is at its fullest.
+
+  After the kernels, each (map, count) also runs the whole filter
+  loop (filterStep()) and counts the heap allocations it makes once
+  warmed up, with and without spatial sorting, and with the pose
+  clusters on. The malloc() family is wrapped for this. The loop
+  must not allocate at all, so any allocation is reported as FAIL
+  and the program exits with status 1.
+*/
+
+#include "ParticleFilters.h"
+#include <time.h>
+#include <errno.h>
+
+#define MAX_SIZES 16
+#define STEADY_WARMUP 5		// filterStep() calls before counting
+#define STEADY_STEPS 20		// filterStep() calls counted
+
+static const char *default_maps[]={"map_A.ppm","map_B.ppm","map_C.ppm","map_D.ppm","maze.ppm"};
+static const int default_sizes[]={100,1000,10000,50000};
+
+// Saved particle set, restored before runs of kernels that modify it
+static struct particle_store saved;
+static struct particle_store work;	// Scratch copies for move()/hit()
+static struct rng_stream benchRng;	// Random stream for moveR()
+static volatile int sink;		// Results the kernels only compute
+static const struct sensor_model *benchModel;	// Model timed by kSensorModel()
+static pf_meas *modelMeas;		// Its readings for the saved set
+static double modelSonar[PF_MAX_BEAMS];	// and the robot's
+static int steadyFailed;		// Some steady-state loop allocated
+static int castFailed;			// gridCastBatch() disagreed with gridCast()
+static pf_meas *castMeas;		// Readings from gridCastBatch()
+static int fusedFailed;			// Fused Step 1+3 disagreed with the separate passes
+
+/**********************************************************
+ Allocation counting. These replace the C library's
+ malloc() family for the whole program and forward to it.
+**********************************************************/
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t align, size_t size);
+
+static int countAllocs;			// Counting switched on
+static long allocCalls;			// Allocations while counting
+
+static inline void countAlloc(void)
+{
+    if (__atomic_load_n(&countAllocs,__ATOMIC_RELAXED)) __atomic_fetch_add(&allocCalls,1,__ATOMIC_RELAXED);
+}
+
+extern "C" void *malloc(size_t size) __THROW
+{
+    countAlloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) __THROW
+{
+    countAlloc();
+    return __libc_calloc(n,size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+    countAlloc();
+    return __libc_realloc(ptr,size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t align, size_t size) __THROW
+{
+    countAlloc();
+    *ptr=__libc_memalign(align,size);
+    return (*ptr!=NULL)?0:ENOMEM;
+}
+
+extern "C" void *aligned_alloc(size_t align, size_t size) __THROW
+{
+    countAlloc();
+    return __libc_memalign(align,size);
+}
+
+static double seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double x=*(const double *)a, y=*(const double *)b;
+    return (x>y)-(x<y);
+}
+
+static void copyStore(struct particle_store *dst, const struct particle_store *src)
+{
+    dst->n=src->n;
+    memcpy(dst->x,src->x,src->n*sizeof(pf_pose));
+    memcpy(dst->y,src->y,src->n*sizeof(pf_pose));
+    memcpy(dst->theta,src->theta,src->n*sizeof(pf_pose));
+    memcpy(dst->prob,src->prob,src->n*sizeof(double));
+    memcpy(dst->measureD,src->measureD,(size_t)src->n*src->beams*sizeof(pf_meas));
+}
+
+/**********************************************************
+ Kernels. Each runs one pass over the current particle set.
+**********************************************************/
+static void kHit(void)
+{
+    struct particle p;
+    volatile int hits=0;
+    for (int i=0; i<particles.n; i++)
+    {
+        storeLoad(&particles,i,&p);
+        hits+=hit(&p,map,sx,sy);
+    }
+}
+
+static void kGridHit(void)
+{
+    struct particle p;
+    volatile int hits=0;
+    for (int i=0; i<particles.n; i++)
+    {
+        storeLoad(&particles,i,&p);
+        hits+=gridHit(&occGrid,&p);
+    }
+}
+
+static void kMove(void)
+{
+    struct particle p;
+    for (int i=0; i<work.n; i++)
+    {
+        storeLoad(&work,i,&p);
+        move(&p,1.0);
+        storeSave(&work,i,&p);
+    }
+}
+
+static void kMoveR(void)
+{
+    struct particle p;
+    for (int i=0; i<work.n; i++)
+    {
+        storeLoad(&work,i,&p);
+        moveR(&p,1.0,&benchRng);
+        storeSave(&work,i,&p);
+    }
+}
+
+static void kGroundTruth(void)
+{
+    struct particle p;
+    for (int i=0; i<particles.n; i++)
+    {
+        storeLoad(&particles,i,&p);
+        ground_truth(&p,map,sx,sy);
+    }
+}
+
+static void kGridGroundTruth(void)
+{
+    struct particle p;
+    for (int i=0; i<particles.n; i++)
+    {
+        storeLoad(&particles,i,&p);
+        gridGroundTruth(&occGrid,&p);
+    }
+}
+
+static void kGridCast(void)
+{
+    double d[PF_MAX_BEAMS];
+    for (int i=0; i<particles.n; i++) gridCast(&occGrid,particles.x[i],particles.y[i],d);
+}
+
+static void kGridCastBatch(void)
+{
+    gridCastBatch(&occGrid,particles.x,particles.y,particles.n,castMeas);
+}
+
+static void kSonar(void)
+{
+    struct particle p;
+    for (int i=0; i<particles.n; i++)
+    {
+        storeLoad(&particles,i,&p);
+        sonar_measurement(&p,map,sx,sy);
+    }
+}
+
+static void kMoveParticles(void)
+{
+    double move_distance=1.0;
+    moveParticles(&move_distance,0,particles.n,0,0);
+}
+
+static void kLikelihood(void)
+{
+    for (int i=0; i<particles.n; i++) computeLikelihood(&particles,i,robotSonar);
+}
+
+static void kLikelihoodBatch(void)
+{
+    likelihoodChunk(NULL,0,particles.n,0,0);
+}
+
+static void kSensorModel(void)
+{
+    benchModel->batch(modelMeas,particles.n,modelSonar,particles.prob);
+}
+
+static void kNormalize(void)
+{
+    normalizeProbabilities(&particles);
+}
+
+static void kResample(void)
+{
+    resample();
+}
+
+static void kInitParticles(void)
+{
+    initParticles();
+}
+
+static void kSort(void)
+{
+    sortParticles(&spatialSort,&particles);
+}
+
+static void kCentralized(void)
+{
+    sink=isCentralized(&particles,100);
+}
+
+static void kClusters(void)
+{
+    findClusters(&clusters,particles.x,particles.y,particles.theta,particles.prob,particles.n);
+}
+
+static void kFused(void)
+{
+    weighParticles(1.0);
+    makeBeliefs();
+    sink=(estimate.set_var_x<100&&estimate.set_var_y<100);
+}
+
+static int bestBelief(void)
+{
+    // The scan the filter used to report its estimate with
+    double max=0.0;
+    int best=0;
+    for (int i=0; i<particles.n; i++)
+        if (particles.prob[i]>max)
+        {
+            max=particles.prob[i];
+            best=i;
+        }
+    return best;
+}
+
+static void kSeparate(void)
+{
+    kMoveParticles();
+    kLikelihoodBatch();
+    normalizeProbabilities(&particles);
+    sink=isCentralized(&particles,100);
+    sink=bestBelief();
+}
+
+static void checkFused(const char *map_name)
+{
+    // The same frame both ways, from the saved set
+    copyStore(&particles,&saved);
+    kSeparate();
+    int best=bestBelief();
+    double mx=0.0, my=0.0, vx=0.0, vy=0.0, ux=0.0, uy=0.0, uvx=0.0, uvy=0.0;
+    for (int i=0; i<particles.n; i++)
+    {
+        mx+=particles.prob[i]*particles.x[i];
+        my+=particles.prob[i]*particles.y[i];
+        ux+=particles.x[i];
+        uy+=particles.y[i];
+    }
+    ux/=particles.n;
+    uy/=particles.n;
+    for (int i=0; i<particles.n; i++)
+    {
+        vx+=particles.prob[i]*(particles.x[i]-mx)*(particles.x[i]-mx);
+        vy+=particles.prob[i]*(particles.y[i]-my)*(particles.y[i]-my);
+        uvx+=(particles.x[i]-ux)*(particles.x[i]-ux);
+        uvy+=(particles.y[i]-uy)*(particles.y[i]-uy);
+    }
+    uvx/=particles.n;
+    uvy/=particles.n;
+    memcpy(work.prob,particles.prob,particles.n*sizeof(double));
+
+    copyStore(&particles,&saved);
+    kFused();
+    double err=0.0;
+    for (int i=0; i<particles.n; i++) err=fmax(err,fabs(particles.prob[i]-work.prob[i]));
+    double tol=1e-9*(1.0+fabs(mx)+fabs(my));
+    if (estimate.best!=best||err>1e-12||fabs(estimate.x-mx)>tol||fabs(estimate.y-my)>tol||
+        fabs(estimate.var_x-vx)>1e-6*(1.0+vx)||fabs(estimate.var_y-vy)>1e-6*(1.0+vy)||
+        fabs(estimate.set_var_x-uvx)>1e-6*(1.0+uvx)||fabs(estimate.set_var_y-uvy)>1e-6*(1.0+uvy))
+    {
+        printf("%-22s %-10s %6d FAIL: best %d/%d, belief error %.3g, mean (%.4f,%.4f)/(%.4f,%.4f)\n","step13_check",map_name,
+               particles.n,estimate.best,best,err,estimate.x,estimate.y,mx,my);
+        fusedFailed=1;
+    }
+    copyStore(&particles,&saved);
+}
+
+/**********************************************************
+ Harness
+**********************************************************/
+// State to reset before each run of a kernel
+enum restore_what{KEEP, RESTORE_WEIGHTS, RESTORE_SET, RESTORE_WORK};
+
+static void restoreState(enum restore_what what)
+{
+    switch (what)
+    {
+        case RESTORE_WEIGHTS:
+            memcpy(particles.prob,saved.prob,saved.n*sizeof(double));
+            break;
+        case RESTORE_SET:
+            copyStore(&particles,&saved);
+            break;
+        case RESTORE_WORK:
+            copyStore(&work,&saved);
+            break;
+        default:
+            break;
+    }
+}
+
+static void runKernel(FILE *csv, const char *map_name, const char *kname, void (*fn)(void),
+                      enum restore_what restore, int warmup, int reps)
+{
+    double *t=(double *)malloc(reps*sizeof(double));
+    if (t==NULL) return;
+
+    for (int r=0; r<warmup; r++)
+    {
+        restoreState(restore);
+        fn();
+    }
+    for (int r=0; r<reps; r++)
+    {
+        restoreState(restore);
+        double t0=seconds();
+        fn();
+        t[r]=1000.0*(seconds()-t0);
+    }
+    restoreState(restore);
+
+    qsort(t,reps,sizeof(double),cmpDouble);
+    double median=(reps%2)?t[reps/2]:0.5*(t[reps/2-1]+t[reps/2]);
+    int i99=(int)ceil(0.99*reps)-1;
+    double p99=t[i99<0?0:i99];
+    double ns=1e6*median/saved.n;
+
+    printf("%-22s %-10s %6d %10.4f %10.4f %10.4f %10.1f\n",kname,map_name,saved.n,median,p99,t[0],ns);
+    if (csv!=NULL)
+    {
+        fprintf(csv,"%s,%s,%d,%d,%.6f,%.6f,%.6f,%.2f\n",kname,map_name,saved.n,reps,median,p99,t[0],ns);
+        fflush(csv);
+    }
+    free(t);
+}
+
+static void checkSteadyState(const char *map_name, int n)
+{
+    // Heap allocations made by STEADY_STEPS iterations of the whole
+    // filter loop, once the buffers have grown to size
+    n_particles=n;
+    initParticles();
+    localizationAchieved=true;	// Keep the convergence message out of the table
+    for (int i=0; i<STEADY_WARMUP; i++) filterStep();
+
+    allocCalls=0;
+    __atomic_store_n(&countAllocs,1,__ATOMIC_RELAXED);
+    for (int i=0; i<STEADY_STEPS; i++) filterStep();
+    __atomic_store_n(&countAllocs,0,__ATOMIC_RELAXED);
+    localizationAchieved=false;
+
+    char kname[64];
+    snprintf(kname,sizeof(kname),"allocs_%s",sortCurveName(spatialSort.curve));
+    printf("%-22s %-10s %6d %10ld per %d iterations %s\n",kname,map_name,n,allocCalls,STEADY_STEPS,allocCalls==0?"ok":"FAIL");
+    if (allocCalls!=0) steadyFailed=1;
+}
+
+static void benchSize(FILE *csv, const char *map_name, int n, int warmup, int reps)
+{
+    char kname[64];
+
+    // Fresh, reproducible particle set with measurements and weights
+    // as they are right after Step 3 of a filter iteration
+    srand48(12345);
+    rngSeed=12345;
+    filterSteps=0;
+    rngStream(&benchRng,54321,RNG_MOVE,0,0);
+    n_particles=n;
+    initParticles();
+    kMoveParticles();
+    kLikelihoodBatch();
+
+    freeStore(&saved);
+    freeStore(&work);
+    if (initStore(&saved,n,particles.beams)!=0||initStore(&work,n,particles.beams)!=0)
+    {
+        fprintf(stderr,"Out of memory\n");
+        exit(1);
+    }
+    copyStore(&saved,&particles);
+    copyStore(&work,&particles);
+
+    // Injection rate of a filter that has been running for a while
+    iterations=100;
+
+    runKernel(csv,map_name,"hit",kHit,KEEP,warmup,reps);
+    runKernel(csv,map_name,"gridHit",kGridHit,KEEP,warmup,reps);
+    runKernel(csv,map_name,"move",kMove,RESTORE_WORK,warmup,reps);
+    runKernel(csv,map_name,"moveR",kMoveR,RESTORE_WORK,warmup,reps);
+    runKernel(csv,map_name,"ground_truth",kGroundTruth,KEEP,warmup,reps);
+    runKernel(csv,map_name,"gridGroundTruth",kGridGroundTruth,KEEP,warmup,reps);
+    runKernel(csv,map_name,"gridCast",kGridCast,KEEP,warmup,reps);
+    runKernel(csv,map_name,"sonar_measurement",kSonar,KEEP,warmup,reps);
+    runKernel(csv,map_name,"step1_moveParticles",kMoveParticles,RESTORE_SET,warmup,reps);
+    runKernel(csv,map_name,"computeLikelihood",kLikelihood,RESTORE_WEIGHTS,warmup,reps);
+    runKernel(csv,map_name,"likelihood_batch",kLikelihoodBatch,RESTORE_WEIGHTS,warmup,reps);
+    runKernel(csv,map_name,"normalizeProbabilities",kNormalize,RESTORE_WEIGHTS,warmup,reps);
+    runKernel(csv,map_name,"step13_separate",kSeparate,RESTORE_SET,warmup,reps);
+    runKernel(csv,map_name,"step13_fused",kFused,RESTORE_SET,warmup,reps);
+    checkFused(map_name);
+
+    // Every sensor model's kernel, on readings cast with its beams
+    modelMeas=(pf_meas *)malloc((size_t)n*PF_MAX_BEAMS*sizeof(pf_meas));
+    castMeas=(pf_meas *)malloc((size_t)n*PF_MAX_BEAMS*sizeof(pf_meas));
+    if (modelMeas==NULL||castMeas==NULL)
+    {
+        fprintf(stderr,"Out of memory\n");
+        exit(1);
+    }
+    for (int m=0; (benchModel=sensorModelAt(m))!=NULL; m++)
+    {
+        double d[PF_MAX_BEAMS];
+        struct rng_stream rng;
+        gridSetBeams(&occGrid,benchModel->beams,benchModel->angle);
+        for (int i=0; i<n; i++)
+        {
+            gridCast(&occGrid,saved.x[i],saved.y[i],d);
+            for (int k=0; k<benchModel->beams; k++) modelMeas[(size_t)i*benchModel->beams+k]=measEncode(d[k]);
+        }
+        rngStream(&rng,12345,RNG_ROBOT,0,0);
+        gridSonar(&occGrid,robot,modelSonar,&rng);
+        snprintf(kname,sizeof(kname),"likelihood_%d_%s",benchModel->beams,noiseModelName(benchModel->noise));
+        runKernel(csv,map_name,kname,kSensorModel,RESTORE_WEIGHTS,warmup,reps);
+
+        // The batched casts must match gridCast() exactly
+        if (benchModel->noise!=NOISE_GAUSSIAN) continue;
+        gridCastBatch(&occGrid,saved.x,saved.y,n,castMeas);
+        size_t bad=0;
+        for (size_t j=0; j<(size_t)n*benchModel->beams; j++) bad+=(castMeas[j]!=modelMeas[j]);
+        if (bad!=0)
+        {
+            printf("%-22s %-10s %6d FAIL: %zu of %zu readings differ\n","gridCastBatch_check",map_name,n,bad,(size_t)n*benchModel->beams);
+            castFailed=1;
+        }
+    }
+    gridSetBeams(&occGrid,sensor->beams,sensor->angle);
+    runKernel(csv,map_name,"gridCastBatch",kGridCastBatch,KEEP,warmup,reps);
+    free(modelMeas);
+    free(castMeas);
+
+    // The endpoint model instead of the beam model
+    if (buildLikelihoodField(&field,&occGrid,sensor)!=0)
+    {
+        fprintf(stderr,"Out of memory\n");
+        exit(1);
+    }
+    runKernel(csv,map_name,"likelihood_field",kLikelihoodBatch,RESTORE_WEIGHTS,warmup,reps);
+    runKernel(csv,map_name,"step1_field",kMoveParticles,RESTORE_SET,warmup,reps);
+    runKernel(csv,map_name,"step13_field_separate",kSeparate,RESTORE_SET,warmup,reps);
+    runKernel(csv,map_name,"step13_field_fused",kFused,RESTORE_SET,warmup,reps);
+    freeLikelihoodField(&field);
+
+    // resample() needs normalized weights
+    normalizeProbabilities(&particles);
+    copyStore(&saved,&particles);
+    for (int s=RESAMPLE_NAIVE; s<=RESAMPLE_RESIDUAL; s++)
+    {
+        if (s==RESAMPLE_NAIVE&&n>10000) continue;
+        resampleScheme=(enum resample_scheme)s;
+        snprintf(kname,sizeof(kname),"resample_%s",resampleSchemeName(resampleScheme));
+        runKernel(csv,map_name,kname,kResample,RESTORE_SET,warmup,reps);
+    }
+    resampleScheme=RESAMPLE_SYSTEMATIC;
+
+    runKernel(csv,map_name,"isCentralized",kCentralized,KEEP,warmup,reps);
+    runKernel(csv,map_name,"findClusters",kClusters,KEEP,warmup,reps);
+    runKernel(csv,map_name,"initParticles",kInitParticles,RESTORE_SET,warmup,reps);
+
+    // Cost of the spatial reorder, and Step 1 on the reordered set
+    // (the unordered set is kept in 'work')
+    copyStore(&work,&saved);
+    for (int c=SORT_MORTON; c<=SORT_HILBERT; c++)
+    {
+        initSpatialSort(&spatialSort,(enum sort_curve)c,sx,sy);
+        snprintf(kname,sizeof(kname),"sort_%s",sortCurveName(spatialSort.curve));
+        runKernel(csv,map_name,kname,kSort,RESTORE_SET,warmup,reps);
+
+        sortParticles(&spatialSort,&particles);
+        copyStore(&saved,&particles);
+        snprintf(kname,sizeof(kname),"step1_%s_order",sortCurveName(spatialSort.curve));
+        runKernel(csv,map_name,kname,kMoveParticles,RESTORE_SET,warmup,reps);
+
+        freeSpatialSort(&spatialSort);
+        copyStore(&particles,&work);
+        copyStore(&saved,&work);
+    }
+
+    // The filter loop must not touch the heap
+    checkSteadyState(map_name,n);
+    initSpatialSort(&spatialSort,SORT_HILBERT,sx,sy);
+    checkSteadyState(map_name,n);
+    freeSpatialSort(&spatialSort);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *maps[64];
+    int n_maps=0;
+    int sizes[MAX_SIZES];
+    int n_sizes=0;
+    int reps=20, warmup=3;
+    const char *out="bench_results.csv";
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i],"--reps")&&i+1<argc) reps=atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--warmup")&&i+1<argc) warmup=atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--out")&&i+1<argc) out=argv[++i];
+        else if (!strcmp(argv[i],"--sizes")&&i+1<argc)
+        {
+            for (char *tok=strtok(argv[++i],","); tok!=NULL&&n_sizes<MAX_SIZES; tok=strtok(NULL,","))
+                sizes[n_sizes++]=atoi(tok);
+        }
+        else if (argv[i][0]!='-'&&n_maps<64) maps[n_maps++]=argv[i];
+        else
+        {
+            fprintf(stderr,"Unknown option %s\n",argv[i]);
+            return 1;
+        }
+    }
+    if (reps<1) reps=1;
+    if (n_maps==0)
+        for (int i=0; i<(int)(sizeof(default_maps)/sizeof(default_maps[0])); i++) maps[n_maps++]=default_maps[i];
+    if (n_sizes==0)
+        for (int i=0; i<(int)(sizeof(default_sizes)/sizeof(default_sizes[0])); i++) sizes[n_sizes++]=default_sizes[i];
+
+    FILE *csv=fopen(out,"w");
+    if (csv==NULL) fprintf(stderr,"Unable to open %s, not writing results file\n",out);
+    else fprintf(csv,"kernel,map,particles,reps,median_ms,p99_ms,min_ms,ns_per_particle\n");
+
+    // Single threaded: kernels are measured, not the machine
+    pool=NULL;
+    sensor=findSensorModel(PF_BEAMS,NOISE_GAUSSIAN);
+    memset(&rayTable,0,sizeof(rayTable));
+    memset(&particles,0,sizeof(particles));
+    memset(&saved,0,sizeof(saved));
+    memset(&work,0,sizeof(work));
+    resampleScheme=RESAMPLE_SYSTEMATIC;
+
+    fprintf(stderr,"%d warmup + %d timed runs per kernel, %s likelihood kernel, %s ray casting, %s particles (%d bytes)\n",warmup,reps,likelihoodKernel(),rayBatchKernel(),
+#ifdef PF_COMPACT
+            "compact",
+#else
+            "double",
+#endif
+            (int)(3*sizeof(pf_pose)+sizeof(double)+PF_BEAMS*sizeof(pf_meas)));
+    printf("%-22s %-10s %6s %10s %10s %10s %10s\n","kernel","map","N","median_ms","p99_ms","min_ms","ns/part");
+    for (int m=0; m<n_maps; m++)
+    {
+        map=readPPMimage(maps[m],&sx,&sy);
+        if (map==NULL)
+        {
+            fprintf(stderr,"Unable to open %s, skipping\n",maps[m]);
+            continue;
+        }
+        if (buildOccupancyGrid(&occGrid,map,sx,sy)!=0||buildFreeSpace(&freeSpace,map,sx,sy)!=0)
+        {
+            fprintf(stderr,"No free space in %s, skipping\n",maps[m]);
+            freeOccupancyGrid(&occGrid);
+            free(map);
+            continue;
+        }
+        struct rng_stream rng;
+        rngStream(&rng,12345,RNG_PLACE,0,0);
+        robot=gridInitRobot(&occGrid,&rng);
+        senseRobot(&rng);
+        if (initClusters(&clusters,sx,sy,4,20.0,45.0)!=0)
+        {
+            fprintf(stderr,"Out of memory\n");
+            exit(1);
+        }
+
+        const char *base=strrchr(maps[m],'/');
+        base=(base!=NULL)?base+1:maps[m];
+        for (int s=0; s<n_sizes; s++)
+            if (sizes[s]>0) benchSize(csv,base,sizes[s],warmup,reps);
+
+        deleteList(robot);
+        freeClusters(&clusters);
+        freeFreeSpace(&freeSpace);
+        freeOccupancyGrid(&occGrid);
+        free(map);
+    }
+
+    if (csv!=NULL)
+    {
+        fclose(csv);
+        fprintf(stderr,"Results written to %s\n",out);
+    }
+    freeStore(&particles);
+    freeArena(&arena);
+    freeStore(&saved);
+    freeStore(&work);
+    if (castFailed) fprintf(stderr,"Batched ray casts differ from gridCast()\n");
+    if (fusedFailed) fprintf(stderr,"The fused Step 1+3 pass differs from the separate passes\n");
+    if (steadyFailed) fprintf(stderr,"The filter loop allocated memory after warming up\n");
+    return (castFailed||fusedFailed||steadyFailed)?1:0;
+}
@@ -42,7 +42,12 @@
 unsigned char *map;		// Input map
 unsigned char *map_b;		// Temporary frame
 struct particle *robot;		// Robot
-struct particle *list;		// Particle list
+double robotSonar[PF_MAX_BEAMS];	// Robot's latest readings, one per sensor beam
+const struct sensor_model *sensor;	// Beam count and noise model used for weighting
+struct likelihood_field field;		// Endpoint model instead of ray casting (optional)
+struct particle_store particles;	// Particle set
+struct particle_arena arena;	// Second particle buffer for resample()
+struct particle *list;		// Linked list view of the snapshot being drawn
 int sx,sy;			// Size of the map image
 char name[1024];		// Name of the map
 int n_particles;		// Number of particles
@@ -53,15 +58,44 @@ int RESETflag;			// RESET particles
 int iterations;
 bool localizationAchieved;
 
+struct ray_table rayTable;	// Precomputed ground truth (optional)
+struct free_space freeSpace;	// Free pixels of the map, for uniform placement
+struct occupancy_grid occGrid;	// Walls of the map, one bit per pixel
+struct map_cache mapCache;	// mmap()ed map cache (optional)
+int rayTableMB;			// Memory budget for rayTable, 0 = disabled
+
+struct thread_pool *pool;	// Workers for the per-particle stages
+int n_threads;			// Requested pool size, 0 = one per CPU
+uint64_t rngSeed;		// Seed of every random stream (see RandomStream.h)
+unsigned int filterSteps;	// filterStep() calls so far, names each step's streams
+
+enum resample_scheme resampleScheme;	// How resample() picks parents
+struct kld_sampler kld;			// Adaptive particle count (optional)
+struct measure_memo memo;		// Per-frame ground truth memo (optional)
+struct spatial_sort spatialSort;	// Particle reordering after resampling (optional)
+struct frame_estimate estimate;		// Weighted reductions of the last frame
+struct pose_clusters clusters;		// Pose hypotheses of the last frame (optional)
+
+// Per-block reductions of the fused Step 1+3 pass, merged in block order
+#define FUSE_BLOCK 256			// Smallest block of the fused pass
+#define FUSE_MAX_BLOCKS 4096
+static struct weight_moments blockMoments[FUSE_MAX_BLOCKS];
+
+struct view_channel viewChannel;	// Snapshots from the filter thread to the viewer
+pthread_t filterThread;			// Runs the filter while the viewer draws
+int filterRunning;			// Cleared to stop filterThread
+GLuint mapTexture;			// Viewer frame, updated in place
+
 /**********************************************************
  PROGRAM CODE
 **********************************************************/
+#ifndef PF_NO_MAIN	// Defined when the filter is linked into another program (see bench.sh)
 int main(int argc, char *argv[])
 {
  /*
    Main function. Usage for this program:
 
-   ParticleFilters map_name n_particles
+   ParticleFilters [options] map_name n_particles [options]
 
    Where:
     map_name is the name of a .ppm file containing the map. The map
@@ -71,54 +105,378 @@ int main(int argc, char *argv[])
 
     n_particles is the number of particles to simulate in [100, 50000]
 
+   Options:
+    --headless      run the filter without a display, as fast as
+                    possible, printing the pose error of every
+                    iteration and the throughput (see runHeadless()).
+    --iters K       number of iterations to run with --headless
+                    (default 500).
+    --beams B       number of sonar beams, 8, 16 (default), 32 or 64.
+    --noise NAME    sensor noise model used to weight particles,
+                    gaussian (default) or laplace (see Likelihood.h).
+    --sensor MODEL  'beam' (default) compares the robot's readings
+                    with ray casts from each particle, 'field' scores
+                    the endpoints of the readings on a precomputed
+                    likelihood field with no ray casting at all (see
+                    LikelihoodField.h).
+    --ray-table MB  precompute ground_truth() readings for the map
+                    using at most MB megabytes, and use table lookups
+                    instead of ray casting in the filter loop. Only
+                    with 16 beams.
+    --sort CURVE    reorder the particles along a space-filling curve
+                    after resampling, 'morton' or 'hilbert' (default
+                    'none'), so ray casts of consecutive particles touch
+                    the same part of the map (see SpatialSort.h).
+    --memo Q        reuse ground truth readings within each frame for
+                    particles in the same Q x Q pixel cell (see
+                    MeasureMemo.h). Ignored with --ray-table. Only
+                    with 16 beams.
+    --map-cache DIR keep the preprocessed map (occupancy grid, free
+                    space, ray-cast table) in a binary cache file in
+                    DIR and mmap() it on later runs (see MapCache.h).
+    --threads N     number of threads for the particle update stages
+                    (default: one per CPU, or 1 per trial with --trials).
+    --trials M      run M independent localizations from different
+                    start poses and seeds, with no display, and print
+                    an aggregate report (see TrialRunner.h). Each runs
+                    for --iters iterations.
+    --jobs J        number of trials to run at a time (default: one
+                    per CPU).
+    --seed S        seed for all random numbers (default 12345). The
+                    results only depend on the seed, not on --threads.
+                    With --trials, trial t uses S+t.
+    --stats FILE    collect stage timings and counters (see FilterStats.h)
+                    and write them to FILE, as JSON lines if the name
+                    ends in .json, CSV otherwise.
+    --stats-every K write the stats every K iterations (default 1).
+    --resample S    resampling scheme: systematic (default), stratified,
+                    residual, multinomial, or naive (the original
+                    O(N^2) version, for comparison).
+    --kld MIN:MAX   adapt the number of particles with KLD-sampling
+                    (see KldSampling.h), keeping it in [MIN, MAX].
+                    n_particles is the count the filter starts with.
+    --kld-eps E     KL divergence bound for --kld (default 0.05).
+    --kld-bin PX[:DEG]  histogram bin size for --kld, in pixels and
+                    optionally degrees (default 10 pixels, 360 degrees).
+    --clusters K[:PX[:DEG]]  report the K (at most 16) heaviest clusters
+                    of the particle set every frame, found on a
+                    histogram of PX pixel, DEG degree bins (default 20
+                    pixels, 45 degrees), and use the heaviest as the
+                    pose estimate instead of the best particle (see
+                    PoseClusters.h).
+
    Main loads the map image, initializes a robot at a random location
     in the map, and sets up the OpenGL stuff before entering the
-    filtering loop.
+    filtering loop (or runs the headless driver).
  */
+ char *positional[2];
+ int n_positional=0;
+ bool headless=false;
+ int iters=500;
+ char *stats_file=NULL;
+ int stats_every=1;
+ int kld_min=0,kld_max=0;
+ int trials=0,jobs=0;
+ char *cache_dir=NULL;
+ double memo_q=0.0;
+ enum sort_curve sort_curve=SORT_NONE;
+ int beams=PF_BEAMS;
+ bool use_field=false;
+ enum noise_model noise=NOISE_GAUSSIAN;
+ bool write_cache=false;
+ long seed=12345;
+ double kld_eps=0.05,kld_bin_xy=10.0,kld_bin_theta=360.0;
+ int cluster_k=0;
+ double cluster_bin_xy=20.0,cluster_bin_theta=45.0;
+
+ rayTableMB=0;
+ n_threads=0;
+ resampleScheme=RESAMPLE_SYSTEMATIC;
+ for (int i=1; i<argc; i++)
+ {
+  if (argv[i][0]!='-')
+  {
+   if (n_positional<2) positional[n_positional]=argv[i];
+   n_positional++;
+  }
+  else if (!strcmp(argv[i],"--headless")) headless=true;
+  else if (!strcmp(argv[i],"--iters")&&i+1<argc) iters=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--stats")&&i+1<argc) stats_file=argv[++i];
+  else if (!strcmp(argv[i],"--stats-every")&&i+1<argc) stats_every=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--ray-table")&&i+1<argc) rayTableMB=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--beams")&&i+1<argc) beams=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--sensor")&&i+1<argc)
+  {
+   i++;
+   if (!strcmp(argv[i],"field")) use_field=true;
+   else if (strcmp(argv[i],"beam"))
+   {
+    fprintf(stderr,"Unknown sensor model %s\n",argv[i]);
+    exit(0);
+   }
+  }
+  else if (!strcmp(argv[i],"--noise")&&i+1<argc)
+  {
+   int model=noiseModelFromName(argv[++i]);
+   if (model<0)
+   {
+    fprintf(stderr,"Unknown noise model %s\n",argv[i]);
+    exit(0);
+   }
+   noise=(enum noise_model)model;
+  }
+  else if (!strcmp(argv[i],"--map-cache")&&i+1<argc) cache_dir=argv[++i];
+  else if (!strcmp(argv[i],"--memo")&&i+1<argc) memo_q=atof(argv[++i]);
+  else if (!strcmp(argv[i],"--sort")&&i+1<argc)
+  {
+   int curve=sortCurveFromName(argv[++i]);
+   if (curve<0)
+   {
+    fprintf(stderr,"Unknown curve %s\n",argv[i]);
+    exit(0);
+   }
+   sort_curve=(enum sort_curve)curve;
+  }
+  else if (!strcmp(argv[i],"--threads")&&i+1<argc) n_threads=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--trials")&&i+1<argc) trials=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--jobs")&&i+1<argc) jobs=atoi(argv[++i]);
+  else if (!strcmp(argv[i],"--seed")&&i+1<argc) seed=atol(argv[++i]);
+  else if (!strcmp(argv[i],"--kld")&&i+1<argc)
+  {
+   if (sscanf(argv[++i],"%d:%d",&kld_min,&kld_max)!=2)
+   {
+    fprintf(stderr,"--kld expects MIN:MAX\n");
+    exit(0);
+   }
+  }
+  else if (!strcmp(argv[i],"--kld-eps")&&i+1<argc) kld_eps=atof(argv[++i]);
+  else if (!strcmp(argv[i],"--kld-bin")&&i+1<argc) sscanf(argv[++i],"%lf:%lf",&kld_bin_xy,&kld_bin_theta);
+  else if (!strcmp(argv[i],"--clusters")&&i+1<argc)
+  {
+   if (sscanf(argv[++i],"%d:%lf:%lf",&cluster_k,&cluster_bin_xy,&cluster_bin_theta)<1)
+   {
+    fprintf(stderr,"--clusters expects K[:PX[:DEG]]\n");
+    exit(0);
+   }
+  }
+  else if (!strcmp(argv[i],"--resample")&&i+1<argc)
+  {
+   int scheme=resampleSchemeFromName(argv[++i]);
+   if (scheme<0)
+   {
+    fprintf(stderr,"Unknown resampling scheme %s\n",argv[i]);
+    exit(0);
+   }
+   resampleScheme=(enum resample_scheme)scheme;
+  }
+  else
+  {
+   fprintf(stderr,"Unknown option %s\n",argv[i]);
+   exit(0);
+  }
+ }
 
- if (argc!=3)
+ if (n_positional!=2)
  {
-  fprintf(stderr,"Wrong number of parameters. Usage: ParticleFilters map_name n_particles.\n");
+  fprintf(stderr,"Wrong number of parameters. Usage: ParticleFilters [--headless] map_name n_particles [options].\n");
   exit(0);
  }
 
- strcpy(&name[0],argv[1]);
- n_particles=atoi(argv[2]);
+ strcpy(&name[0],positional[0]);
+ n_particles=atoi(positional[1]);
 
  if (n_particles<100||n_particles>50000)
  {
   fprintf(stderr,"Number of particles must be in [100, 50000]\n");
   exit(0);
  }
+ sensor=findSensorModel(beams,noise);
+ if (sensor==NULL)
+ {
+  fprintf(stderr,"No %d beam sensor model, use 8, 16, 32 or 64 beams\n",beams);
+  exit(0);
+ }
+ if (use_field&&(rayTableMB>0||memo_q>0.0))
+ {
+  fprintf(stderr,"The likelihood field does no ray casting, --ray-table and --memo ignored\n");
+  rayTableMB=0;
+  memo_q=0.0;
+ }
+ if (sensor->beams!=PF_BEAMS&&(rayTableMB>0||memo_q>0.0))
+ {
+  fprintf(stderr,"--ray-table and --memo only work with %d beams, ignored\n",PF_BEAMS);
+  rayTableMB=0;
+  memo_q=0.0;
+ }
+ if (kld_max>0&&(kld_min<100||kld_max>50000||kld_min>kld_max))
+ {
+  fprintf(stderr,"KLD bounds must satisfy 100 <= MIN <= MAX <= 50000\n");
+  exit(0);
+ }
 
- fprintf(stderr,"Reading input map\n");
- map=readPPMimage(name,&sx, &sy);
- if (map==NULL)
+ double t_map=statsClock();
+ memset(&mapCache,0,sizeof(mapCache));
+ memset(&occGrid,0,sizeof(occGrid));
+ memset(&freeSpace,0,sizeof(freeSpace));
+ if (cache_dir!=NULL&&openMapCache(&mapCache,cache_dir,name)==0&&(map=(unsigned char *)mapCacheImage(&mapCache))!=NULL&&
+     mapCacheGrid(&mapCache,&occGrid)==0&&mapCacheFreeSpace(&mapCache,&freeSpace)==0)
+ {
+  sx=mapCache.sx;
+  sy=mapCache.sy;
+  fprintf(stderr,"Using map cache for %s\n",name);
+ }
+ else
+ {
+  closeMapCache(&mapCache);
+  fprintf(stderr,"Reading input map\n");
+  map=readPPMimage(name,&sx, &sy);
+  if (map==NULL)
+  {
+   fprintf(stderr,"Unable to open input map, or not a .ppm file\n");
+   exit(0);
+  }
+
+  // Collision tests and ray casting use the bit-packed grid, the
+  // RGB image is only used for display from here on
+  if (buildOccupancyGrid(&occGrid,map,sx,sy)!=0)
+  {
+   fprintf(stderr,"Out of memory building the occupancy grid\n");
+   free(map);
+   exit(0);
+  }
+  if (buildFreeSpace(&freeSpace,map,sx,sy)!=0)
+  {
+   fprintf(stderr,"Map has no free space, or out of memory\n");
+   free(map);
+   exit(0);
+  }
+  write_cache=(cache_dir!=NULL);
+ }
+ gridSetBeams(&occGrid,sensor->beams,sensor->angle);
+ memset(&field,0,sizeof(field));
+ if (use_field&&buildLikelihoodField(&field,&occGrid,sensor)!=0)
  {
-  fprintf(stderr,"Unable to open input map, or not a .ppm file\n");
+  fprintf(stderr,"Out of memory building the likelihood field\n");
   exit(0);
  }
 
- // Allocate memory for the temporary frame
- fprintf(stderr,"Allocating temp. frame\n");
- map_b=(unsigned char *)calloc(sx*sy*3,sizeof(unsigned char));
- if (map_b==NULL)
+ if (trials>0) headless=true;
+
+ // Allocate memory for the temporary frame (only the viewer needs it)
+ map_b=NULL;
+ if (!headless)
+ {
+  fprintf(stderr,"Allocating temp. frame\n");
+  map_b=(unsigned char *)calloc(sx*sy*3,sizeof(unsigned char));
+ }
+ if (!headless&&map_b==NULL)
  {
   fprintf(stderr,"Out of memory allocating image data\n");
   free(map);
   exit(0);
  }
 
-//  srand48((long)time(NULL));		// Initialize random generator from timer
-  srand48(12345);
- // CHANGE the line above to 'srand48(12345);'  to get a consistent sequence of random numbers for testing and debugging your code!
- 
+ // Trials create their own pools after fork(), threads don't survive it
+ pool=(trials>0)?NULL:createPool(n_threads);
+ fprintf(stderr,"Using %d thread(s), %d beam %s %s model, %s likelihood kernel, %s ray casting\n",
+         trials>0?(n_threads>0?n_threads:1):poolWorkers(pool),sensor->beams,noiseModelName(sensor->noise),
+         field.logp!=NULL?"likelihood field":"beam",likelihoodKernel(),rayBatchKernel());
+ if (stats_file!=NULL&&trials>0)
+ {
+  fprintf(stderr,"--stats is not supported with --trials, ignored\n");
+  stats_file=NULL;
+ }
+ if (stats_file!=NULL&&statsEnable(poolWorkers(pool),stats_file,stats_every)!=0)
+ {
+  fprintf(stderr,"Unable to open stats file %s\n",stats_file);
+  exit(0);
+ }
+
+ memset(&kld,0,sizeof(kld));
+ if (kld_max>0)
+ {
+  // z for delta = 0.01
+  if (initKld(&kld,sx,sy,kld_min,kld_max,kld_eps,2.326,kld_bin_xy,kld_bin_theta)!=0)
+  {
+   fprintf(stderr,"Invalid KLD-sampling parameters\n");
+   exit(0);
+  }
+  if (n_particles<kld_min) n_particles=kld_min;
+  if (n_particles>kld_max) n_particles=kld_max;
+  fprintf(stderr,"KLD-sampling between %d and %d particles, %dx%dx%d bins\n",kld_min,kld_max,kld.gx,kld.gy,kld.gt);
+ }
+
+ memset(&clusters,0,sizeof(clusters));
+ if (cluster_k>0)
+ {
+  if (initClusters(&clusters,sx,sy,cluster_k,cluster_bin_xy,cluster_bin_theta)!=0)
+  {
+   fprintf(stderr,"Invalid --clusters parameters, or out of memory\n");
+   exit(0);
+  }
+  fprintf(stderr,"Pose clusters: top %d, %dx%dx%d bins\n",clusters.k,clusters.gx,clusters.gy,clusters.gt);
+ }
+
+ memset(&rayTable,0,sizeof(rayTable));
+ if (rayTableMB>0&&mapCacheRayTable(&mapCache,&rayTable,(size_t)rayTableMB<<20)==0)
+  fprintf(stderr,"Ray-cast table from map cache: %dx%d samples, stride %d\n",rayTable.tx,rayTable.ty,rayTable.stride);
+ else if (rayTableMB>0)
+ {
+  fprintf(stderr,"Building ray-cast table...\n");
+  if (buildRayTable(&rayTable,&occGrid,(size_t)rayTableMB<<20,trials>0?0:poolWorkers(pool))!=0)
+   fprintf(stderr,"Ray-cast table does not fit in %d MB, using ray casting\n",rayTableMB);
+  else
+  {
+   fprintf(stderr,"Ray-cast table: %dx%d samples, stride %d\n",rayTable.tx,rayTable.ty,rayTable.stride);
+   write_cache=(cache_dir!=NULL);
+  }
+ }
+ if (initSpatialSort(&spatialSort,sort_curve,sx,sy)!=0)
+ {
+  fprintf(stderr,"Map is too big for --sort\n");
+  exit(0);
+ }
+
+ memset(&memo,0,sizeof(memo));
+ if (memo_q>0.0&&rayTable.dist==NULL)
+ {
+  // Trials make their own pools, of n_threads workers
+  int workers=(trials>0)?(n_threads>0?n_threads:1):poolWorkers(pool);
+  if (initMemo(&memo,memo_q,workers,kld.enabled?kld.max:n_particles)!=0)
+  {
+   fprintf(stderr,"Invalid --memo cell size, or out of memory\n");
+   exit(0);
+  }
+  fprintf(stderr,"Ground truth memo: %.3g pixel cells\n",memo_q);
+ }
+ if (write_cache)
+ {
+  if (writeMapCache(cache_dir,mapCache.hash,map,sx,sy,&occGrid,&freeSpace,&rayTable)==0)
+   fprintf(stderr,"Map cache written to %s\n",cache_dir);
+  else
+   fprintf(stderr,"Unable to write map cache to %s\n",cache_dir);
+ }
+ fprintf(stderr,"Map ready in %.1f ms\n",1000.0*(statsClock()-t_map));
+
+ // Every random number is drawn from a stream derived from the seed,
+ // use --seed to get a different sequence
+ rngSeed=(uint64_t)seed;
+ filterSteps=0;
+
+ if (trials>0)
+ {
+  runTrials(trials,jobs,iters,seed,n_threads);
+  cleanUp();
+  exit(0);
+ }
 
  // INITIALIZE the robot at a random location and orientation.
  iterations = 1;
  localizationAchieved = false;
  fprintf(stderr,"Init robot...\n");
- robot=initRobot(map,sx,sy);
+ struct rng_stream rng;
+ rngStream(&rng,rngSeed,RNG_PLACE,0,0);
+ robot=gridInitRobot(&occGrid,&rng);
  if (robot==NULL)
  {
   fprintf(stderr,"Unable to initialize robot.\n");
@@ -126,13 +484,32 @@ int main(int argc, char *argv[])
   free(map_b);
   exit(0);
  }
- sonar_measurement(robot,map,sx,sy);	// Initial measurements...
+ senseRobot(&rng);	// Initial measurements...
 
  // Initialize particles at random locations
  fprintf(stderr,"Init particles...\n");
  list=NULL;
+ memset(&particles,0,sizeof(particles));
  initParticles();
 
+ if (headless)
+ {
+  fprintf(stderr,"Running %d headless iterations...\n",iters);
+  runHeadless(iters);
+  cleanUp();
+  exit(0);
+ }
+
+ // The viewer draws snapshots of the filter state, starting with
+ // the initial set
+ if (initViewChannel(&viewChannel,kld.enabled?kld.max:n_particles)!=0||
+     viewPublish(&viewChannel,&particles,robot,estimate.best_x,estimate.best_y,estimate.best_theta,0)!=0)
+ {
+  fprintf(stderr,"Out of memory allocating viewer snapshots\n");
+  cleanUp();
+  exit(0);
+ }
+
  // Done, set up OpenGL and call particle filter loop
  fprintf(stderr,"Entering main loop...\n");
  Win[0]=800;
@@ -145,71 +522,79 @@ int main(int argc, char *argv[])
  exit(0);
 
 }
+#endif
 
 void initParticles(void)
 {
  /*
-   This function creates and returns a linked list of particles
-   initialized with random locations (not over obstacles or walls)
-   and random orientations.
+   This function initializes the particle store with particles at
+   random locations (not over obstacles or walls) and random
+   orientations.
 
    There is a utility function to help you find whether a particle
    is on top of a wall.
 
-   Use the global pointer 'list' to keep trak of the *HEAD* of the
-   linked list.
+   Use the global store 'particles' to keep track of the set. It
+   and the resampling arena are sized here for the largest set the
+   filter can have (n_particles, or the KLD bound), and only grow,
+   so the filter loop itself never allocates.
 
    Probabilities should be uniform for the initial set.
  */
 
- list=NULL;
+ int cap=n_particles;
+ if (kld.enabled&&kld.max>cap) cap=kld.max;
+ // The likelihood field needs no stored readings
+ int beams=(field.logp!=NULL)?0:sensor->beams;
+ if (reserveStore(&particles,cap,beams)!=0||reserveArena(&arena,cap,beams)!=0)
+ {
+  fprintf(stderr,"Out of memory allocating particles\n");
+  exit(0);
+ }
 
  /***************************************************************
  // TO DO: Complete this function to generate an initially random
- //        list of particles.
+ //        set of particles.
  ***************************************************************/
-  srand(time(NULL));
-  
  // Create and initialize n_particles
  for (int i = 0; i < n_particles; i++) {
-     // Allocate memory for a new particle
-     struct particle *newParticle = (struct particle*)malloc(sizeof(struct particle));
-     
-     int validPosition = 0;  // Flag to ensure valid particle placement
-
-     // Keep trying until a valid position is found
-     while (!validPosition) {
-         // Randomly initialize the particle's x and y positions within map bounds
-         newParticle->x = rand() % sx;
-         newParticle->y = rand() % sy;
-
-         // Use the hit function to check if this position is valid (not on a wall)
-         if (!hit(newParticle, map, sx, sy)) {
-             validPosition = 1;  // Valid position found
-         }
-     }
+     // Each particle draws from its own stream
+     struct rng_stream rng;
+     rngStream(&rng, rngSeed, RNG_INIT, filterSteps, i);
+
+     // Pick a uniformly random free pixel (not on a wall) from the
+     // free-space index, no retries needed
+     freeSpacePick(&freeSpace, rngUniform(&rng), &particles.x[i], &particles.y[i]);
 
      // Randomly assign a heading/direction (theta) in degrees
-     newParticle->theta = ((double)rand() / RAND_MAX) * 360.0;
+     particles.theta[i] = rngUniform(&rng) * 360.0;
 
      // Set the initial probability (uniform distribution across particles)
-     newParticle->prob = 1.0 / n_particles;
-
-     // Add the new particle to the front of the linked list
-     newParticle->next = list;
-     list = newParticle;
+     particles.prob[i] = 1.0 / n_particles;
  }
-
+ particles.n = n_particles;
+
+ // No frame yet: every belief is equal, report the first particle
+ memset(&estimate, 0, sizeof(estimate));
+ if (particles.n > 0) {
+  estimate.best_x = particles.x[0];
+  estimate.best_y = particles.y[0];
+  estimate.best_theta = particles.theta[0];
+ }
+ clusters.n_hyp = 0;
+ clusters.clusters = 0;
 }
 
-void computeLikelihood(struct particle *p, struct particle *rob, double noise_sigma)
+void computeLikelihood(struct particle_store *s, int i, const double *sonar)
 {
  /*
-   This function computes the likelihood of a particle p given the sensor
-   readings from robot 'robot'.
+   This function computes the likelihood of particle i in store s given
+   the sensor readings 'sonar' from the robot.
 
-   Both particles and robot have a measurements array 'measureD' with 16
-   entries corresponding to 16 sonar slices.
+   Both particles and robot have one measurement per sonar slice of
+   the sensor model (16 by default). For the robot these are in
+   'sonar', for the particle they are the row returned by
+   storeMeasure(s,i).
 
    The likelihood of a particle depends on how closely its measureD
    values match the values the robot is 'observing' around it. Of
@@ -230,18 +615,21 @@ void computeLikelihood(struct particle *p, struct particle *rob, double noise_si
 
    Assume each sonar-slice measurement is independent, and if
 
-   error_i = (p->measureD[i])-(sonar->measureD[i])
+   error_i = (measureD[i])-(sonar[i])
 
    is the error for slice i, the probability of observing such an
-   error is given by a Gaussian distribution with sigma=20 (the
-   noise standard deviation hardcoded into the robot's sonar).
+   error is given by the sensor model's noise distribution, by
+   default a Gaussian with sigma=20 (the noise standard deviation of
+   the robot's sonar).
 
    You may want to check your numbers are not all going to zero...
    (this can happen easily when you multiply many small numbers
     together).
 
-   This function updates the Belief B(p_i) for the particle 
-   stored in 'p->prob'
+   To avoid exactly that, the likelihood is computed in the log
+   domain: this function stores log(likelihood) in 's->prob[i]', and
+   normalizeProbabilities() turns the log-likelihoods into the
+   Belief B(p_i) with the log-sum-exp trick.
  */
 
  /****************************************************************
@@ -249,116 +637,237 @@ void computeLikelihood(struct particle *p, struct particle *rob, double noise_si
  //        likelihood given the robot's measurements
  ****************************************************************/
 
-  double likelihood = 1.0;  // Start with likelihood 1
+  // Sum of the per-slice log densities (see Likelihood.h), or of the
+  // readings' endpoints on the likelihood field (LikelihoodField.h)
+  if (field.logp != NULL)
+    fieldLikelihoodBatch(&field, &occGrid, &s->x[i], &s->y[i], 1, sonar, &s->prob[i]);
+  else
+    s->prob[i] = logLikelihood(sensor, storeMeasure(s, i), sonar);
+}
 
-  for (int i = 0; i < 16; i++) {
-      double error = p->measureD[i] - rob->measureD[i];  // Difference in measurements
-      double probability = (1.0 / (sqrt(2 * M_PI) * noise_sigma)) *
-                            exp(-(error * error) / (2 * noise_sigma * noise_sigma));
+void moveParticles(void *arg, int begin, int end, int chunk, int worker)
+{
+ /*
+   Step 1 of the filter loop for particles [begin, end): move each
+   particle, bounce it off walls, and update its ground truth
+   readings. Runs on the thread pool, so it uses moveR() with the
+   particle's own random stream for this step instead of
+   move()/rand(): the result does not depend on which worker moves
+   which particle.
+
+   Ray-cast readings are taken after the whole chunk has moved, in
+   one gridCastBatch() call (see RayBatch.h).
+ */
+    double move_distance = *(double *)arg;
+    double d[PF_MAX_BEAMS];
+    struct rng_stream rng;
+    struct particle scratch;
+    struct particle *p = &scratch;
+    long retries = 0;
+    bool cast = (field.logp == NULL && rayTable.dist == NULL && !memo.enabled);
+
+    for (int i = begin; i < end; i++) {
+        // Work on a scratch copy so the ParticleUtils functions can be used
+        storeLoad(&particles, i, p);
+        rngStream(&rng, rngSeed, RNG_MOVE, filterSteps, i);
 
-      // Multiply probabilities for each sonar slice
-      likelihood *= probability;
-  }
+        // Move the particle forward
+        moveR(p, move_distance, &rng);
 
-  // Set the particle's probability
-  p->prob = likelihood;
+        // Check if particle hits a wall, and "bounce" if so
+        if(gridHit(&occGrid, p)) {
+            int validTheta = 0;
+            while (!validTheta) {
+                double oldx = p->x;
+                double oldy = p->y;
+                p->theta = rngUniform(&rng) * 360.0;
+                moveR(p, move_distance, &rng);
+                if (!gridHit(&occGrid, p)) {
+                    validTheta = 1;
+                } else {
+                    p->x = oldx;
+                    p->y = oldy;
+                }
+                retries++;
+            }
+        }
+
+        // Update the particle's expected measurement (ground truth),
+        // from the precomputed table when there is one. The
+        // likelihood field doesn't need it, and ray casts are batched
+        // below.
+        storeSave(&particles, i, p);
+        if (field.logp != NULL || cast) {
+            continue;
+        } else if (rayTable.dist != NULL) {
+            rayTableLookup(&rayTable, p->x, p->y, d);
+        } else {
+            memoGroundTruth(&memo, &occGrid, worker, p->x, p->y, d);
+        }
+        storeSetMeasure(&particles, i, d);
+    }
+    if (cast)
+        gridCastBatch(&occGrid, &particles.x[begin], &particles.y[begin], end - begin, storeMeasure(&particles, begin));
+    statsBounces(worker, retries);
 }
 
-void normalizeProbabilities(struct particle *list) {
-    double total_prob = 0.0;
-    struct particle *p = list;
+void likelihoodChunk(void *arg, int begin, int end, int chunk, int worker)
+{
+    // Step 3 for particles [begin, end): the same as calling
+    // computeLikelihood() on each, through the sensor model's
+    // vectorized batch kernel, or the likelihood field
+    if (field.logp != NULL)
+        fieldLikelihoodBatch(&field, &occGrid, &particles.x[begin], &particles.y[begin], end - begin, robotSonar,
+                             &particles.prob[begin]);
+    else
+        sensor->batch(storeMeasure(&particles, begin), end - begin, robotSonar, &particles.prob[begin]);
+}
 
-    // Calculate total probability (sum of likelihoods)
-    while (p != NULL) {
-        total_prob += p->prob;
-        p = p->next;
-    }
+void fusedChunk(void *arg, int begin, int end, int chunk, int worker)
+{
+ /*
+   Steps 1 and 3 for block [begin, end) in one go: move the block
+   and take its ground truth, weight it against the robot's
+   readings, and fold the weights and poses into the block's
+   summary (FrameEstimate.h) while they are still in cache.
+ */
+    moveParticles(arg, begin, end, chunk, worker);
+    likelihoodChunk(NULL, begin, end, chunk, worker);
+    momentsBlock(&blockMoments[chunk], &particles.prob[begin], &particles.x[begin], &particles.y[begin],
+                 &particles.theta[begin], end - begin, begin);
+}
 
-    // Normalize each particle’s probability
-    p = list;
-    while (p != NULL) {
-        if (total_prob > 0) {
-            p->prob /= total_prob; // Normalize to convert likelihood to belief
-        } else {
-            p->prob = 1.0 / n_particles;  // Handle edge case if all probabilities are zero
-        }
-        p = p->next;
+static void beliefChunk(void *arg, int begin, int end, int chunk, int worker)
+{
+    // Block weights to beliefs, one multiply each (see blockScale())
+    double s = blockScale(&blockMoments[chunk], &estimate);
+    for (int i = begin; i < end; i++) particles.prob[i] *= s;
+}
+
+static int fuseBlockSize(int n)
+{
+    // Fixed blocks, so the merge order never depends on the pool
+    int block = FUSE_BLOCK;
+    if (poolChunks(n, block) > FUSE_MAX_BLOCKS) block = (n + FUSE_MAX_BLOCKS - 1) / FUSE_MAX_BLOCKS;
+    return block;
+}
+
+void weighParticles(double move_distance)
+{
+    // The pool runs the fused pass over fixed size blocks, then the
+    // block summaries are merged in order into the frame estimate
+    int block = fuseBlockSize(particles.n);
+    struct weight_moments all;
+
+    poolRun(pool, fusedChunk, &move_distance, particles.n, block);
+    momentsClear(&all);
+    for (int c = 0; c < poolChunks(particles.n, block); c++) momentsMerge(&all, &blockMoments[c]);
+    finishEstimate(&estimate, &all);
+}
+
+void makeBeliefs(void)
+{
+    // Beliefs from the weights weighParticles() left, with the
+    // normalizer of the estimate. If no weight is usable the set is
+    // made uniform, as logNormalize() does.
+    if (estimate.valid) {
+        poolRun(pool, beliefChunk, NULL, particles.n, fuseBlockSize(particles.n));
+    } else {
+        for (int i = 0; i < particles.n; i++) particles.prob[i] = 1.0 / particles.n;
+        estimate.ess = particles.n;
     }
 }
 
-struct particle *resample(void) {
-    // construct a new list of particles
-    struct particle *new_list = NULL;
+void senseRobot(struct rng_stream *rng)
+{
+    // Sonar readings at the robot's pose, one per beam of the sensor
+    // model. The viewer draws the 16 slices of robot->measureD, so
+    // those are filled in for the default sensor.
+    gridSonar(&occGrid, robot, robotSonar, rng);
+    if (sensor->beams == PF_BEAMS) memcpy(robot->measureD, robotSonar, sizeof(robot->measureD));
+}
+
+void normalizeProbabilities(struct particle_store *s) {
+    // prob[] holds log-likelihoods; convert them to beliefs that sum
+    // to 1 with log-sum-exp, so the set can't underflow to all zeros
+    logNormalize(pool, s->prob, s->n);
+}
+
+void resample(void) {
+    struct rng_stream rng;
+    rngStream(&rng, rngSeed, RNG_RESAMPLE, filterSteps, 0);
+
+    // With KLD-sampling, size the new set to the spread of the
+    // current (predicted) one and how many of its particles agree
+    // with the measurement (see KldSampling.h)
+    if (kld.enabled) {
+        n_particles = kldSampleCount(&kld, kldBins(&kld, particles.x, particles.y, particles.theta, particles.n),
+                                     particles.n, estimate.ess);
+    }
+
+    // The new set goes into the arena's spare buffer (already big
+    // enough unless n_particles was raised since initParticles())
+    if (reserveArena(&arena, n_particles, particles.beams) != 0) {
+        fprintf(stderr, "Out of memory resampling particles\n");
+        return;
+    }
+    int *parent = arena.parent;
+    struct particle_store *new_set = &arena.spare;
+
+    // Pick the parent of every new particle in one sweep over the
+    // cumulative weights (see Resample.h for the schemes)
+    resampleIndices(resampleScheme, particles.prob, particles.n, parent, n_particles, &rng);
 
     for (int i = 0; i < n_particles; i++) {
-        double cumulative_prob = 0.0;
-        double r = rand() / (double)RAND_MAX;  // Random number between 0 and 1
-
-        struct particle *p = list;
-        while (p != NULL) {
-            cumulative_prob += p->prob;
-            if (cumulative_prob >= r) {
-                // Copy the particle to the new list
-                struct particle *new_particle = (struct particle*)malloc(sizeof(struct particle));
-                new_particle->x = p->x;
-                new_particle->y = p->y;
-                new_particle->theta = p->theta;
-                new_particle->prob = 1.0 / n_particles;  // Initialize with uniform probability
-                new_particle->next = new_list;
-                new_list = new_particle;
-                break;
-            }
-            p = p->next;
-        }
+        int j = parent[i];
+        // Copy the particle to the new set
+        new_set->x[i] = particles.x[j];
+        new_set->y[i] = particles.y[j];
+        new_set->theta[i] = particles.theta[j];
+        new_set->prob[i] = 1.0 / n_particles;  // Initialize with uniform probability
     }
+    new_set->n = n_particles;
 
-    deleteList(list);  // Free memory for the old list
+    // The old set becomes the spare for the next frame
+    swapStore(&particles, new_set);
 
     // uniformly randomize upto 5% of the particles (less if higher iterations)
     int num_random = n_particles * 0.05 * (1.0 / (iterations/100.0));
-    for (int i = 0; i < num_random; i++) {
-        struct particle *p = new_list;
-        int random_particle = rand() % n_particles;
-        for (int j = 0; j < random_particle; j++) {
-            p = p->next;
-        }
-
-        int validPosition = 0;
-        while(!validPosition) {
-            p->x = rand() % sx;
-            p->y = rand() % sy;
-            p->theta = ((double)rand() / RAND_MAX) * 360.0;
-            if (!hit(p, map, sx, sy)) {
-                validPosition = 1;
-            }
-        }
+    statsInjected(num_random);
+    for (int i = 0; i < num_random && particles.n > 0; i++) {
+        // O(1) pick of the particle to replace
+        int random_particle = (int)(rngUniform(&rng) * particles.n);
+
+        // and O(1) pick of a free pixel to put it on
+        freeSpacePick(&freeSpace, rngUniform(&rng), &particles.x[random_particle], &particles.y[random_particle]);
+        particles.theta[random_particle] = rngUniform(&rng) * 360.0;
     }
 
-    return new_list;
+    // Put particles that are close on the map next to each other, for
+    // the ray casts in the next Step 1
+    if (sortParticles(&spatialSort, &particles) != 0)
+        fprintf(stderr, "Out of memory sorting particles\n");
 }
 
-bool isCentralized(struct particle *list, double threshold) {
+bool isCentralized(struct particle_store *s, double threshold) {
+    // The filter loop reads the same test off the frame estimate
+    // (see filterStep()); this is the two-pass version over a set
     double mean_x = 0.0, mean_y = 0.0;
-    int count = 0;
-    struct particle *p = list;
+    int count = s->n;
 
     // Calculate mean position of particles
-    while (p != NULL) {
-        mean_x += p->x;
-        mean_y += p->y;
-        count++;
-        p = p->next;
+    for (int i = 0; i < count; i++) {
+        mean_x += s->x[i];
+        mean_y += s->y[i];
     }
     mean_x /= count;
     mean_y /= count;
 
     // Calculate variance
     double variance_x = 0.0, variance_y = 0.0;
-    p = list;
-    while (p != NULL) {
-        variance_x += (p->x - mean_x) * (p->x - mean_x);
-        variance_y += (p->y - mean_y) * (p->y - mean_y);
-        p = p->next;
+    for (int i = 0; i < count; i++) {
+        variance_x += (s->x[i] - mean_x) * (s->x[i] - mean_x);
+        variance_y += (s->y[i] - mean_y) * (s->y[i] - mean_y);
     }
     variance_x /= count;
     variance_y /= count;
@@ -368,25 +877,17 @@ bool isCentralized(struct particle *list, double threshold) {
     return (variance_x < threshold && variance_y < threshold);
 }
 
-void ParticleFilterLoop(void)
+void filterStep(void)
 {
  /*
-    Main loop of the particle filter
+    One iteration of the particle filter: predict, sense, weight,
+    resample and check for convergence. Used by both the OpenGL
+    viewer and the headless driver.
  */
 
-  // OpenGL variables. Do not remove
-  unsigned char *tmp;
-  GLuint texture;
-  static int first_frame=1;
-  double max;
-  struct particle *p,*pmax;
-  char line[1024];
-
   iterations += n_particles / 1000;  // Increase iterations by 1 every 1000 particles
   // Add any local variables you need right below.
 
-  if (!first_frame)
-  {
    // Step 1 - Move all particles a given distance forward (this will be in
    //          whatever direction the particle is currently looking).
    //          To avoid at this point the problem of 'navigating' the
@@ -405,53 +906,27 @@ void ParticleFilterLoop(void)
    //        You should see a moving robot and sonar figure with
    //        a set of moving particles.
    ******************************************************************/
-    struct particle *p = list;
     double move_distance = 1.0; // Define a small move distance for each particle
+    double t = statsBegin();
+    struct rng_stream rng;
 
-    while (p != NULL) {
-        // Move the particle forward
-        move(p, move_distance);
-
-        // Check if particle hits a wall, and "bounce" if so
-        // if (hit(p, map, sx, sy)) {
-        //     // Assign a random direction if it hits a wall
-        //     p->theta = ((double)rand() / RAND_MAX) * 360.0;
-        // }
-
-        if(hit(p, map, sx, sy)) {
-            int validTheta = 0;
-            while (!validTheta) {
-                double oldx = p->x;
-                double oldy = p->y;
-                p->theta = ((double)rand() / RAND_MAX) * 360.0;
-                move(p, move_distance);
-                if (!hit(p, map, sx, sy)) {
-                    validTheta = 1;
-                } else {
-                    p->x = oldx;
-                    p->y = oldy;
-                }
-            }
-        }
-
-        // Update the particle's expected measurement (ground truth)
-        ground_truth(p, map, sx, sy);
+    // This step's random streams (see RandomStream.h)
+    filterSteps++;
+    if (memo.enabled) memoNewFrame(&memo);
 
-        // Move to the next particle in the list
-        p = p->next;
-    }
-
-    // Move the robot forward the same distance
-    move(robot, move_distance);
+    // The particles are moved below, together with Step 3, once the
+    // robot has its readings. Move the robot forward first.
+    rngStream(&rng, rngSeed, RNG_ROBOT, filterSteps, 0);
+    moveR(robot, move_distance, &rng);
     
-    if (hit(robot, map, sx, sy)) {
+    if (gridHit(&occGrid, robot)) {
         int validTheta = 0;
         while (!validTheta) {
             double oldx = robot->x;
             double oldy = robot->y;
-            robot->theta = ((double)rand() / RAND_MAX) * 360.0;
-            move(robot, move_distance);
-            if (!hit(robot, map, sx, sy)) {
+            robot->theta = rngUniform(&rng) * 360.0;
+            moveR(robot, move_distance, &rng);
+            if (!gridHit(&occGrid, robot)) {
                 validTheta = 1;
             } else {
                 robot->x = oldx;
@@ -460,12 +935,9 @@ void ParticleFilterLoop(void)
         }
     }
 
-    // // Update the robot's actual sonar measurement
-    // sonar_measurement(robot, map, sx, sy);
-    
-
    // Step 2 - The robot makes a measurement - use the sonar
-   sonar_measurement(robot,map,sx,sy);
+   senseRobot(&rng);
+   statsEnd(STAGE_SENSE, t);
 
    // Step 3 - Compute the likelihood for particles based on the sensor
    //          measurement. See 'computeLikelihood()' and call it for
@@ -482,27 +954,31 @@ void ParticleFilterLoop(void)
    //        should be brightest.
    *******************************************************************/
 
-  // Step 3: Compute the likelihood for each particle
-  //struct particle *p = list;
-p = list; // Start from the head of the list
-
-while (p != NULL) {
-    // Calculate the likelihood for each particle based on the robot's measurement
-    computeLikelihood(p, robot, 20.0); // Assume noise_sigma = 20
-
-    // Move to the next particle in the list
-    p = p->next;
-}
+  // Steps 1 and 3 for the particles, in one pass (see fusedChunk())
+t = statsBegin();
+weighParticles(move_distance);
+statsEnd(STAGE_PREDICT, t);
 
 // Now normalize all likelihoods to convert them to beliefs
-normalizeProbabilities(list);
+t = statsBegin();
+makeBeliefs();
+statsEnd(STAGE_NORMALIZE, t);
+statsWeights(particles.prob, particles.n);
+
+// Where the belief is, while the beliefs still match the poses (see
+// PoseClusters.h)
+if (clusters.enabled) {
+    t = statsBegin();
+    findClusters(&clusters, particles.x, particles.y, particles.theta, particles.prob, particles.n);
+    statsEnd(STAGE_CLUSTERS, t);
+}
    // Step 4 - Resample particle set based on the probabilities. The goal
    //          of this is to obtain a particle set that better reflect our
    //          current belief on the location and direction of motion
    //          for the robot. Particles that have higher probability will
    //          be selected more often than those with lower probability.
    //
-   //          To do this: Create a separate (new) list of particles,
+   //          To do this: Create a separate (new) set of particles,
    //                      for each of 'n_particles' new particles,
    //                      randomly choose a particle from  the current
    //                      set with probability given by the particle
@@ -513,10 +989,10 @@ normalizeProbabilities(list);
    //                      have high probability may end up being
    //                      copied multiple times.
    //
-   //                      Once you have a new list of particles, replace
-   //                      the current list with the new one. Be sure
-   //                      to release the memory for the current list
-   //                      before you lose that pointer!
+   //                      Once you have a new set of particles, replace
+   //                      the current set with the new one. Be sure
+   //                      to release the memory for the current set
+   //                      before you lose it!
    //
 
    /*******************************************************************
@@ -526,30 +1002,220 @@ normalizeProbabilities(list);
    //        Hopefully the largest cluster will be on and around
    //        the robot's actual location/direction.
    *******************************************************************/
-  list = resample();
-
-  // need to figure out if we achieved localization    
-  if (!localizationAchieved && isCentralized(list, 100)) {  // Assume 1.0 is the threshold for centralization
+  t = statsBegin();
+  resample();
+  statsEnd(STAGE_RESAMPLE, t);
+
+  // need to figure out if we achieved localization. The fused pass
+  // already has the unweighted variance isCentralized() measures, but
+  // of the set before this resample(): last frame's resampled set,
+  // moved one step. So the test passes one frame later than it would
+  // on the set just drawn, with no extra pass over it. It stays on
+  // the unweighted spread: the weights collapse long before the set
+  // has gathered (see FrameEstimate.h), so the weight of the heaviest
+  // cluster would call it localized in the first frames.
+  t = statsBegin();
+  if (!localizationAchieved && particles.n > 0 && estimate.set_var_x < 100 && estimate.set_var_y < 100) {  // Same threshold as isCentralized()
         localizationAchieved = true;  // Set the flag to stop the loop
         fprintf(stderr, "I found myself!\n");
         // return;
   }
+  statsEnd(STAGE_CONVERGENCE, t);
+}
+
+void reportedPose(double *x, double *y, double *theta)
+{
+ // The heaviest cluster is where most of the belief is; the best
+ // particle is only one sample of it
+ if (clusters.enabled && clusters.n_hyp > 0) {
+  *x = clusters.hyp[0].x;
+  *y = clusters.hyp[0].y;
+  *theta = clusters.hyp[0].theta;
+ } else {
+  *x = estimate.best_x;
+  *y = estimate.best_y;
+  *theta = estimate.best_theta;
+ }
+}
+
+double poseError(double x, double y)
+{
+ // Distance between (x,y) and the robot's true position
+ return sqrt(((robot->x-x)*(robot->x-x))+((robot->y-y)*(robot->y-y)));
+}
+
+static double seconds(void)
+{
+ struct timespec t;
+ clock_gettime(CLOCK_MONOTONIC,&t);
+ return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+void runHeadless(int iters)
+{
+ /*
+   Runs the filter for 'iters' iterations as fast as possible, with no
+   display. One line per iteration goes to stdout:
+
+    iter,error,est_x,est_y,est_theta,ms
+
+   where the estimate is the highest-belief particle of the frame
+   (see FrameEstimate.h), or the heaviest cluster with --clusters
+   (see PoseClusters.h), 'error' its distance to the robot and
+   'ms' the time taken by the iteration. A throughput summary, and
+   the last frame's hypotheses with --clusters, are written to
+   stderr at the end.
+ */
+ double start,t0,t1;
+ int found=-1;
+
+ long n_sum=0;
+ int n_min=n_particles,n_max=n_particles;
+
+ printf("iter,error,est_x,est_y,est_theta,ms,particles\n");
+ start=seconds();
+ for (int it=1; it<=iters; it++)
+ {
+  t0=seconds();
+  filterStep();
+  t1=seconds();
+  statsEndIteration();
+
+  if (found<0&&localizationAchieved) found=it;
+  double ex,ey,et;
+  reportedPose(&ex,&ey,&et);
+  printf("%d,%.3f,%.2f,%.2f,%.2f,%.3f,%d\n",it,poseError(ex,ey),ex,ey,et,1000.0*(t1-t0),particles.n);
+  n_sum+=particles.n;
+  if (particles.n<n_min) n_min=particles.n;
+  if (particles.n>n_max) n_max=particles.n;
+ }
+ double total=seconds()-start;
+
+ fprintf(stderr,"%d iterations of %.0f particles (mean) in %.3f s: %.1f iterations/s, %.3g particle updates/s\n",
+         iters,(double)n_sum/iters,total,iters/total,(double)n_sum/total);
+ if (kld.enabled) fprintf(stderr,"Particle count: min %d, mean %.0f, max %d, final %d\n",n_min,(double)n_sum/iters,n_max,particles.n);
+ if (memo.enabled)
+ {
+  long lookups;
+  double rate=memoHitRate(&memo,&lookups);
+  fprintf(stderr,"Ground truth memo: %.1f%% of %ld lookups hit (%.3g pixel cells)\n",100.0*rate,lookups,memo.quantum);
+ }
+ if (found>0) fprintf(stderr,"Localized at iteration %d\n",found);
+ else fprintf(stderr,"Did not localize\n");
+ if (clusters.enabled)
+ {
+  fprintf(stderr,"Pose hypotheses, %d of %d clusters:\n",clusters.n_hyp,clusters.clusters);
+  for (int h=0; h<clusters.n_hyp; h++)
+  {
+   const struct pose_hypothesis *p=&clusters.hyp[h];
+   fprintf(stderr,"  %5.1f%%  x=%.1f y=%.1f th=%.1f  sd %.1f %.1f %.1f  error %.1f\n",100.0*p->weight,p->x,p->y,p->theta,
+           sqrt(p->var_x),sqrt(p->var_y),sqrt(p->var_theta),poseError(p->x,p->y));
+  }
+ }
+ statsPrintSummary(stderr);
+}
 
-  }  // End if (!first_frame)
+void cleanUp(void)
+{
+ // Release everything main() set up. The filter thread goes first:
+ // it may still be in filterStep(), reading all of it. Whatever was
+ // borrowed from the map cache goes away with its mapping.
+ stopFilterThread();
+ if (mapCacheOwns(&mapCache,map)) map=NULL;
+ if (mapCacheOwns(&mapCache,occGrid.tile)) memset(&occGrid,0,sizeof(occGrid));
+ if (mapCacheOwns(&mapCache,freeSpace.cell)) memset(&freeSpace,0,sizeof(freeSpace));
+ if (mapCacheOwns(&mapCache,rayTable.dist)) memset(&rayTable,0,sizeof(rayTable));
+ closeMapCache(&mapCache);
+ freeViewChannel(&viewChannel);
+ destroyPool(pool);
+ freeStore(&particles);
+ freeArena(&arena);
+ freeRayTable(&rayTable);
+ freeLikelihoodField(&field);
+ freeFreeSpace(&freeSpace);
+ freeOccupancyGrid(&occGrid);
+ freeKld(&kld);
+ freeClusters(&clusters);
+ freeMemo(&memo);
+ freeSpatialSort(&spatialSort);
+ statsDisable();
+ deleteList(robot);
+ free(map);
+ free(map_b);
+}
+
+void *filterThreadMain(void *arg)
+{
+ /*
+    Runs the filter for the OpenGL viewer, as fast as it can go. A
+    snapshot is published whenever the viewer is ready to draw a new
+    one (see ViewSnapshot.h), so the filter is not held back by the
+    display.
+ */
+ int it=0;
+
+ while (__atomic_load_n(&filterRunning,__ATOMIC_ACQUIRE))
+ {
+  filterStep();
+  it++;
+
+  if (__atomic_exchange_n(&RESETflag,0,__ATOMIC_ACQ_REL))	// If user pressed r, reset particles
+  {
+   if (kld.enabled) n_particles=kld.max;	// Global localization again
+   initParticles();
+  }
+  if (viewWanted(&viewChannel))
+  {
+   double t=statsBegin();
+   double ex,ey,et;
+   reportedPose(&ex,&ey,&et);
+   viewPublish(&viewChannel,&particles,robot,ex,ey,et,it);
+   statsEnd(STAGE_RENDER,t);
+  }
+  statsEndIteration();
+ }
+ return NULL;
+}
+
+void stopFilterThread(void)
+{
+ if (!__atomic_exchange_n(&filterRunning,0,__ATOMIC_ACQ_REL)) return;
+ pthread_join(filterThread,NULL);
+}
+
+void ParticleFilterLoop(void)
+{
+ /*
+    Display callback of the OpenGL viewer. The filter runs on its own
+    thread (filterThreadMain()); this draws the latest snapshot it
+    published, at display rate.
+ */
+
+  // OpenGL variables. Do not remove
+  static int first_frame=1;
+  static char line[1024];
+  struct view_snapshot *v;
 
   /***************************************************
    OpenGL stuff
    You DO NOT need to read code below here. It only
    takes care of updating the screen.
   ***************************************************/
-  if (RESETflag)	// If user pressed r, reset particles
+  v=viewAcquire(&viewChannel);
+  if (v!=NULL)
   {
-   deleteList(list);
-   list=NULL;
-   initParticles();
-   RESETflag=0;
+   // New snapshot: redraw the frame and update the texture in place
+   list=storeView(&v->set);
+   renderFrame(map,map_b,sx,sy,&v->robot,list);
+   glBindTexture(GL_TEXTURE_2D, mapTexture);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sx, sy, GL_RGB, GL_UNSIGNED_BYTE, map_b);
+
+   double ex=v->robot.x-v->est_x, ey=v->robot.y-v->est_y;
+   sprintf(&line[0],"X=%3.2f, Y=%3.2f, th=%3.2f, EstX=%3.2f, EstY=%3.2f, Est_th=%3.2f, Error=%f, N=%d",v->robot.x,v->robot.y,\
+           v->robot.theta,v->est_x,v->est_y,v->est_theta,sqrt(ex*ex+ey*ey),v->set.n);
   }
-  renderFrame(map,map_b,sx,sy,robot,list);
+  viewRelease(&viewChannel);
 
   // Clear the screen and depth buffers
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -557,19 +1223,7 @@ normalizeProbabilities(list);
   glLoadIdentity();
   glEnable(GL_TEXTURE_2D);
   glDisable(GL_LIGHTING);
-
-  glGenTextures( 1, &texture);
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glBindTexture( GL_TEXTURE_2D, texture);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-  glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
-
-  glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, sx, sy, 0, GL_RGB, GL_UNSIGNED_BYTE, map_b);
+  glBindTexture(GL_TEXTURE_2D, mapTexture);
 
   // Draw box bounding the viewing area
   glBegin (GL_QUADS);
@@ -583,22 +1237,8 @@ normalizeProbabilities(list);
   glVertex3f (0.0, 700.0, 0.0);
   glEnd ();
 
-  p=list;
-  max=0;
-  while (p!=NULL)
-  {
-   if (p->prob>max)
-   {
-    max=p->prob;
-    pmax=p;
-   }
-   p=p->next;
-  }
-
   if (!first_frame)
   {
-   sprintf(&line[0],"X=%3.2f, Y=%3.2f, th=%3.2f, EstX=%3.2f, EstY=%3.2f, Est_th=%3.2f, Error=%f",robot->x,robot->y,robot->theta,\
-           pmax->x,pmax->y,pmax->theta,sqrt(((robot->x-pmax->x)*(robot->x-pmax->x))+((robot->y-pmax->y)*(robot->y-pmax->y))));
    glColor3f(1.0,1.0,1.0);
    glRasterPos2i(5,22);
    for (int i=0; i<strlen(&line[0]); i++)
@@ -610,23 +1250,25 @@ normalizeProbabilities(list);
   // Swap buffers to enable smooth animation
   glutSwapBuffers();
 
-  glDeleteTextures( 1, &texture );
-
-  // Tell glut window to update ls itself
-  glutSetWindow(windowID);
-  glutPostRedisplay();
-
   if (first_frame)
   {
+   char input[1024];
    fprintf(stderr,"All set! press enter to start\n");
    //gets(&line[0]);
-   if (fgets(line, sizeof(line), stdin) == NULL) {
+   if (fgets(input, sizeof(input), stdin) == NULL) {
     fprintf(stderr, "Error reading input.\n");
     exit(1);
 }
 
-
    first_frame=0;
+   filterRunning=1;
+   if (pthread_create(&filterThread,NULL,filterThreadMain,NULL)!=0)
+   {
+    fprintf(stderr,"Unable to start the filter thread\n");
+    filterRunning=0;
+    cleanUp();
+    exit(0);
+   }
   }
 }
 
@@ -650,14 +1292,33 @@ void initGlut(char* winName)
     // to call when the image needs to be refreshed, and when the
     // image window is being resized.
     glutReshapeFunc(WindowReshape);   // Call WindowReshape whenever window resized
-    glutDisplayFunc(ParticleFilterLoop);   // Main display function is also the main loop
+    glutDisplayFunc(ParticleFilterLoop);   // Main display function draws the filter's snapshots
     glutKeyboardFunc(kbHandler);
+    glutTimerFunc(VIEW_FRAME_MS,viewerTimer,0);
+
+    // Persistent texture for the frame, ParticleFilterLoop() only
+    // updates its contents
+    glGenTextures(1, &mapTexture);
+    glBindTexture(GL_TEXTURE_2D, mapTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, sx, sy, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+}
+
+void viewerTimer(int value)
+{
+    // Redraw at display rate, whatever rate the filter runs at
+    glutPostRedisplay();
+    glutTimerFunc(VIEW_FRAME_MS,viewerTimer,0);
 }
 
 void kbHandler(unsigned char key, int x, int y)
 {
- if (key=='r') {RESETflag=1;}
- if (key=='q') {deleteList(list); free(map); free(map_b); exit(0);}
+ if (key=='r') __atomic_store_n(&RESETflag,1,__ATOMIC_RELEASE);	// Read by the filter thread
+ if (key=='q') {cleanUp(); exit(0);}
 }
 
 void WindowReshape(int w, int h)
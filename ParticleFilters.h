@@ -17,6 +17,7 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<math.h>
+#include<stdbool.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -29,6 +30,53 @@
 #include <GL/glut.h>
 
 #include "ParticleUtils.h"
+#include "ParticleStore.h"
+#include "RandomStream.h"
+#include "RayTable.h"
+#include "ThreadPool.h"
+#include "ParticleMotion.h"
+#include "Resample.h"
+#include "Likelihood.h"
+#include "LikelihoodField.h"
+#include "FilterStats.h"
+#include "KldSampling.h"
+#include "TrialRunner.h"
+#include "FreeSpace.h"
+#include "OccupancyGrid.h"
+#include "RayBatch.h"
+#include "MapCache.h"
+#include "ViewSnapshot.h"
+#include "MeasureMemo.h"
+#include "SpatialSort.h"
+#include "FrameEstimate.h"
+#include "PoseClusters.h"
+
+#define VIEW_FRAME_MS 16		// Viewer redraw period (about 60 Hz)
+
+// Global filter state (defined in ParticleFilters.c)
+extern unsigned char *map;		// Input map
+extern int sx,sy;			// Size of the map image
+extern struct particle *robot;		// Robot
+extern double robotSonar[PF_MAX_BEAMS];	// Robot's latest readings
+extern const struct sensor_model *sensor;	// Sensor model used for weighting
+extern struct likelihood_field field;	// Endpoint model (optional)
+extern struct particle_store particles;	// Particle set
+extern struct particle_arena arena;	// Second particle buffer for resample()
+extern int n_particles;			// Number of particles
+extern int iterations;
+extern bool localizationAchieved;
+extern struct ray_table rayTable;	// Precomputed ground truth (optional)
+extern struct free_space freeSpace;	// Free pixels of the map
+extern struct occupancy_grid occGrid;	// Walls of the map, one bit per pixel
+extern struct thread_pool *pool;	// Workers for the per-particle stages
+extern uint64_t rngSeed;		// Seed of every random stream
+extern unsigned int filterSteps;	// filterStep() calls so far
+extern enum resample_scheme resampleScheme;
+extern struct kld_sampler kld;		// Adaptive particle count (optional)
+extern struct measure_memo memo;	// Per-frame ground truth memo (optional)
+extern struct spatial_sort spatialSort;	// Particle reordering (optional)
+extern struct frame_estimate estimate;	// Weighted reductions of the last frame
+extern struct pose_clusters clusters;	// Pose hypotheses of the last frame (optional)
 
 // Particle Filter functions
 
@@ -36,16 +84,48 @@
 int main(int argc, char *argv[]);		
 // Particle initialization
 void initParticles(void);			
-// Compute likelihood for a particle
-void computeLikelihood(struct particle *p, struct particle *rob, double noise_sigma);
-// Particle resampling
-struct particle *resample(void);		
-// Main loop
+// Compute the log-likelihood for particle i of the store given the
+// robot's readings
+void computeLikelihood(struct particle_store *s, int i, const double *sonar);
+// Step 1 (move + ground truth) for a chunk of particles, run on the pool
+void moveParticles(void *arg, int begin, int end, int chunk, int worker);
+// Step 3 (log-likelihoods) for a chunk of particles, run on the pool
+void likelihoodChunk(void *arg, int begin, int end, int chunk, int worker);
+// Steps 1 and 3 plus the frame reductions for a block of particles
+void fusedChunk(void *arg, int begin, int end, int chunk, int worker);
+// Steps 1 and 3 for the whole set, leaving the frame estimate in
+// 'estimate', then the beliefs from it
+void weighParticles(double move_distance);
+void makeBeliefs(void);
+// Step 2: take the robot's sonar readings into robotSonar
+void senseRobot(struct rng_stream *rng);
+// Turn log-likelihoods into beliefs
+void normalizeProbabilities(struct particle_store *s);
+// True if the particle cloud's position variance is below threshold
+bool isCentralized(struct particle_store *s, double threshold);
+// Particle resampling (replaces the global particle set)
+void resample(void);		
+// One iteration of the filter (predict, weight, resample)
+void filterStep(void);
+// Distance from (x,y) to the robot
+double poseError(double x, double y);
+// Reported pose: the heaviest cluster with --clusters, else the best
+// particle of the last frame
+void reportedPose(double *x, double *y, double *theta);
+// Run the filter without a display for 'iters' iterations
+void runHeadless(int iters);
+// Release all global state
+void cleanUp(void);
+// Filter thread for the OpenGL viewer, and how to stop it
+void *filterThreadMain(void *arg);
+void stopFilterThread(void);
+// Display callback (OpenGL viewer)
 void ParticleFilterLoop(void);
 
 // OpenGL functions - you DO NOT need to modify or read these
 void initGlut(char* winName);
 void WindowReshape(int w, int h);
 void kbHandler(unsigned char key, int x, int y);
+void viewerTimer(int value);
 
 #endif
@@ -0,0 +1,78 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Re-entrant motion model. See ParticleMotion.h
+*/
+
+#include "ParticleMotion.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static double inverseNormal(double u)
+{
+ // Inverse of the standard normal CDF (Acklam's rational
+ // approximation), the same one GaussianNoise() uses.
+ static const double a[6]={-39.69683028665376,220.9460984245205,-275.9285104469687,
+                           138.3577518672690,-30.66479806614716,2.506628277459239};
+ static const double b[5]={-54.47609879822406,161.5858368580409,-155.6989798598866,
+                           66.80131188771972,-13.28068155288572};
+ static const double c[6]={-0.007784894002430293,-0.3223964580411365,-2.400758277161838,
+                           -2.549732539343734,4.374664141464968,2.938163982698783};
+ static const double d[4]={0.007784695709041462,0.3224671290700398,2.445134137142996,
+                           3.754408661907416};
+ double q,r;
+
+ if (u<0.02425)
+ {
+  q=sqrt(-2.0*log(u));
+  return (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/
+         ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+ }
+ if (u>0.97575)
+ {
+  q=sqrt(-2.0*log(1.0-u));
+  return -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5])/
+          ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+ }
+ q=u-0.5;
+ r=q*q;
+ return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q/
+        (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1.0);
+}
+
+double GaussianNoiseR(double mu, double sigma, struct rng_stream *rng)
+{
+ double u=rngUniform(rng);
+ if (u<=0.0) u=1e-300;		// rngUniform() can return exactly 0
+ return mu+sigma*inverseNormal(u);
+}
+
+void moveR(struct particle *p, double dist, struct rng_stream *rng)
+{
+ /*
+   Moves p by a noisy 'dist' pixels along its heading, then lets the
+   heading drift a little. Headings are in degrees, CCW from the
+   vertical, with 0 pointing towards +y in image coordinates.
+ */
+ double a,d,dx,dy,len;
+
+ if (p==NULL) return;
+ a=p->theta*2.0*M_PI/360.0;
+
+ // move() divides the direction by its length, which is 1 only up to
+ // rounding; doing the same keeps the two on the same path
+ dx=-sin(a);
+ dy=cos(a);
+ len=sqrt(dx*dx+dy*dy);
+ dx/=len;
+ dy/=len;
+ d=dist+GaussianNoiseR(0.0,0.1,rng);
+ p->x+=dx*d;
+ p->y+=dy*d;
+
+ p->theta+=GaussianNoiseR(0.0,5.0,rng);
+ if (p->theta<0) p->theta+=360.0;
+ if (p->theta>360.0) p->theta=fmod(p->theta,360.0);
+}
@@ -0,0 +1,25 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Re-entrant motion model.
+
+  move() and GaussianNoise() in ParticleUtils draw from the hidden
+  drand48() generator, so they cannot be called from several
+  threads at once. These versions implement the same motion and
+  noise model but draw from a random stream passed in by the caller
+  (see RandomStream.h), e.g. one per particle.
+*/
+
+#ifndef __ParticleMotion_header
+#define __ParticleMotion_header
+
+#include "ParticleUtils.h"
+#include "RandomStream.h"
+
+// Same as GaussianNoise(), drawing from 'rng'
+double GaussianNoiseR(double mu, double sigma, struct rng_stream *rng);
+
+// Same as move(), drawing from 'rng'
+void moveR(struct particle *p, double dist, struct rng_stream *rng);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Structure-of-arrays particle container. See ParticleStore.h
+*/
+
+#include "ParticleStore.h"
+
+static void *allocField(size_t count, size_t size)
+{
+ // Cache-line aligned array
+ void *mem=NULL;
+ if (posix_memalign(&mem,PF_CACHE_LINE,count*size)!=0) return NULL;
+ return mem;
+}
+
+int initStore(struct particle_store *s, int cap, int beams)
+{
+    memset(s,0,sizeof(struct particle_store));
+    if (cap<1) cap=1;
+    if (beams<0) beams=0;
+
+    s->x=(pf_pose *)allocField(cap,sizeof(pf_pose));
+    s->y=(pf_pose *)allocField(cap,sizeof(pf_pose));
+    s->theta=(pf_pose *)allocField(cap,sizeof(pf_pose));
+    s->prob=(double *)allocField(cap,sizeof(double));
+    if (beams>0) s->measureD=(pf_meas *)allocField((size_t)cap*beams,sizeof(pf_meas));
+    if (s->x==NULL||s->y==NULL||s->theta==NULL||s->prob==NULL||(beams>0&&s->measureD==NULL))
+    {
+        freeStore(s);
+        return -1;
+    }
+    if (beams>0) memset(s->measureD,0,(size_t)cap*beams*sizeof(pf_meas));
+    s->cap=cap;
+    s->beams=beams;
+    return 0;
+}
+
+void freeStore(struct particle_store *s)
+{
+    free(s->x);
+    free(s->y);
+    free(s->theta);
+    free(s->prob);
+    free(s->measureD);
+    free(s->view);
+    memset(s,0,sizeof(struct particle_store));
+}
+
+int reserveStore(struct particle_store *s, int cap, int beams)
+{
+    if (s->cap>=cap&&s->beams==beams) return 0;
+    freeStore(s);
+    return initStore(s,cap,beams);
+}
+
+int reserveArena(struct particle_arena *a, int cap, int beams)
+{
+    if (reserveStore(&a->spare,cap,beams)!=0) return -1;
+    if (a->cap>=cap) return 0;
+    free(a->parent);
+    a->parent=(int *)malloc((size_t)cap*sizeof(int));
+    a->cap=(a->parent!=NULL)?cap:0;
+    return (a->parent!=NULL)?0:-1;
+}
+
+void freeArena(struct particle_arena *a)
+{
+    freeStore(&a->spare);
+    free(a->parent);
+    memset(a,0,sizeof(struct particle_arena));
+}
+
+void swapStore(struct particle_store *a, struct particle_store *b)
+{
+    struct particle_store t=*a;
+    *a=*b;
+    *b=t;
+}
+
+void storeLoad(const struct particle_store *s, int i, struct particle *p)
+{
+    p->x=s->x[i];
+    p->y=s->y[i];
+    p->theta=s->theta[i];
+    p->prob=s->prob[i];
+    p->next=NULL;
+}
+
+void storeSave(struct particle_store *s, int i, const struct particle *p)
+{
+    s->x[i]=p->x;
+    s->y[i]=p->y;
+    s->theta[i]=p->theta;
+    s->prob[i]=p->prob;
+}
+
+struct particle *storeView(struct particle_store *s)
+{
+    if (s->n<=0) return NULL;
+
+    // The view is sized to the store's capacity so it is allocated
+    // once and reused for every frame.
+    if (s->view==NULL)
+    {
+        s->view=(struct particle *)calloc(s->cap,sizeof(struct particle));
+        if (s->view==NULL) return NULL;
+    }
+
+    for (int i=0; i<s->n; i++)
+    {
+        struct particle *p=&s->view[i];
+        p->x=s->x[i];
+        p->y=s->y[i];
+        p->theta=s->theta[i];
+        p->prob=s->prob[i];
+        p->next=(i+1<s->n)?&s->view[i+1]:NULL;
+    }
+    return s->view;
+}
@@ -0,0 +1,164 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Structure-of-arrays particle container.
+
+  The filter used to keep its particles in a linked list of
+  'struct particle' nodes, one malloc() per particle, with the
+  16 sonar readings sitting right next to the pose. Every pass
+  over the set was a pointer chase through cold memory.
+
+  The store keeps each field in its own contiguous, cache-line
+  aligned array so the filter stages stream through exactly the
+  data they need:
+
+   x[i], y[i], theta[i]   - pose of particle i
+   prob[i]                - Belief Bel(p_i) for particle i
+   measureD[i*beams+k]    - ground truth reading k for particle i
+
+  renderFrame() and other code written against the linked list
+  can still be handed a 'struct particle' list through
+  storeView(), which is rebuilt from the arrays on demand.
+
+  Compact format: building with -DPF_COMPACT stores poses as float
+  and readings as 16-bit fixed point (1/PF_MEAS_SCALE pixels, so
+  up to 255 pixels; readings are at most 150), which takes a
+  particle from 160 to 52 bytes:
+
+                  pose      belief    readings      total
+   default        3 x 8     8         16 x 8        160 B
+   PF_COMPACT     3 x 4     8         16 x 2         52 B
+
+  Ground truth readings are whole pixel counts, so they are stored
+  exactly; floats keep poses to within 1e-4 pixels on a 1024 pixel
+  map. Beliefs stay double in both formats: they are summed over
+  the whole set by normalization and resampling, and are only 8 of
+  the 52 bytes. The struct particle scratch copies (storeLoad(),
+  storeSave()) are always double, so code working on those does
+  not change.
+
+  Resampling builds the new set next to the old one. Instead of
+  allocating a store for it every frame, resample() writes into the
+  spare store of a 'struct particle_arena' and swaps it with the
+  live set, so the two buffers take turns. Once both are big enough
+  (reserveArena()) the filter loop does not allocate at all.
+
+  The number of readings per particle ('beams') is set when the
+  store is allocated, so the same code serves the 8, 16, 32 and 64
+  beam sensor models (see Likelihood.h). Stores that are swapped
+  with each other must have the same number of beams. A store
+  allocated with 0 beams keeps no measurements at all.
+*/
+
+#ifndef __ParticleStore_header
+#define __ParticleStore_header
+
+#include "ParticleUtils.h"
+
+#include <stdint.h>
+
+#define PF_BEAMS 16		// Sonar slices of the default sensor
+#define PF_MAX_BEAMS 64		// Largest sensor model (see Likelihood.h)
+#define PF_SONAR_SIGMA 20	// Sonar noise sigma in pixels
+#define PF_SONAR_RANGE 150	// Sonar range in pixels
+#define PF_CACHE_LINE 64	// Alignment for all particle arrays
+
+#ifdef PF_COMPACT
+typedef float pf_pose;		// x, y, theta
+typedef uint16_t pf_meas;	// Reading * PF_MEAS_SCALE
+#define PF_MEAS_SCALE 256.0
+#else
+typedef double pf_pose;
+typedef double pf_meas;
+#endif
+
+struct particle_store{
+ int n;				// Number of particles in use
+ int cap;			// Number of particles allocated
+ int beams;			// Readings per particle
+ pf_pose *x;
+ pf_pose *y;
+ pf_pose *theta;
+ double *prob;
+ pf_meas *measureD;		// n x beams measurement block
+ struct particle *view;		// Linked list view, see storeView()
+};
+
+struct particle_arena{
+ struct particle_store spare;	// Set resample() writes into
+ int *parent;			// Parent of each new particle
+ int cap;			// Particles 'parent' can hold
+};
+
+// Convert a reading to and from its stored form
+static inline pf_meas measEncode(double d)
+{
+#ifdef PF_COMPACT
+ double q=d*PF_MEAS_SCALE+0.5;
+ return (pf_meas)(q<0.0?0.0:(q>65535.0?65535.0:q));
+#else
+ return d;
+#endif
+}
+
+static inline double measDecode(pf_meas m)
+{
+#ifdef PF_COMPACT
+ return m*(1.0/PF_MEAS_SCALE);
+#else
+ return m;
+#endif
+}
+
+// Allocate room for 'cap' particles of 'beams' readings each.
+// Returns 0 on success, or -1 if memory could not be allocated (the
+// store is left empty).
+int initStore(struct particle_store *s, int cap, int beams);
+
+// Release all memory held by the store (including its view)
+void freeStore(struct particle_store *s);
+
+// Make sure the store can hold 'cap' particles of 'beams' readings.
+// Only reallocates (losing the contents) if it is too small or has
+// a different number of beams. Returns 0 on success, -1 if out of
+// memory (the store is left empty).
+int reserveStore(struct particle_store *s, int cap, int beams);
+
+// Make sure the arena can take a resample of up to 'cap' particles
+// of 'beams' readings. Returns 0 on success, -1 if out of memory.
+int reserveArena(struct particle_arena *a, int cap, int beams);
+
+// Release the arena
+void freeArena(struct particle_arena *a);
+
+// Exchange the contents of two stores (no copying)
+void swapStore(struct particle_store *a, struct particle_store *b);
+
+// Copy particle i's pose and belief into a scratch particle so it
+// can be passed to the utilities in ParticleUtils (move(), hit(),
+// ground_truth(), ...). The scratch particle's 'next' is NULL.
+void storeLoad(const struct particle_store *s, int i, struct particle *p);
+
+// Write a scratch particle's pose and belief back into slot i.
+void storeSave(struct particle_store *s, int i, const struct particle *p);
+
+// Pointer to particle i's s->beams measurements
+static inline pf_meas *storeMeasure(const struct particle_store *s, int i)
+{
+ return s->measureD+((size_t)i*s->beams);
+}
+
+// Store readings d[0..s->beams-1] as particle i's measurements
+static inline void storeSetMeasure(struct particle_store *s, int i, const double *d)
+{
+ pf_meas *m=storeMeasure(s,i);
+ for (int k=0; k<s->beams; k++) m[k]=measEncode(d[k]);
+}
+
+// Build (or refresh) a linked list view of the store for code that
+// walks 'struct particle::next', e.g. renderFrame(). Only the pose
+// and belief are copied. The view belongs to the store; do NOT call
+// deleteList() on it, freeStore() releases it.
+struct particle *storeView(struct particle_store *s);
+
+#endif
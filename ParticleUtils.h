@@ -15,7 +15,7 @@
 
 #ifndef __ParticleUtils_header
 
-#define __PArticleUtils_header
+#define __ParticleUtils_header
 
 // General use libs.
 #include<stdio.h>
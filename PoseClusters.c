@@ -0,0 +1,287 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Multi-hypothesis pose estimate. See PoseClusters.h
+*/
+
+#include "PoseClusters.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static inline double wrap180(double d)
+{
+    // An angle difference of two headings in [0, 360] into [-180, 180)
+    d+=(d<-180.0)?360.0:0.0;
+    d-=(d>=180.0)?360.0:0.0;
+    return d;
+}
+
+static inline double wrap360(double t)
+{
+    t+=(t<0.0)?360.0:0.0;
+    t-=(t>=360.0)?360.0:0.0;
+    return t;
+}
+
+int initClusters(struct pose_clusters *c, int sx, int sy, int k, double bin_xy, double bin_theta)
+{
+    memset(c,0,sizeof(struct pose_clusters));
+    if (k<1||k>CLUSTER_MAX_K||bin_xy<=0.0||bin_theta<=0.0) return -1;
+
+    c->k=k;
+    c->bin_xy=bin_xy;
+    c->gx=(int)ceil(sx/bin_xy);
+    c->gy=(int)ceil(sy/bin_xy);
+    c->gt=(int)ceil(360.0/bin_theta);
+    if (c->gx<1) c->gx=1;
+    if (c->gy<1) c->gy=1;
+    if (c->gt<1) c->gt=1;
+    c->bin_theta=360.0/c->gt;	// Heading bins must tile the circle to wrap
+
+    // The border bins are never stamped, so the flood fill can look
+    // at all 8 neighbours in x and y without bounds checks
+    c->px=c->gx+2;
+    c->plane=c->px*(c->gy+2);
+    size_t bins=(size_t)c->plane*c->gt;
+    size_t cells=(size_t)c->gx*c->gy*c->gt;
+    c->mark=(struct cluster_mark *)calloc(bins,sizeof(struct cluster_mark));
+    c->bin=NULL;	// One cache line per bin
+    if (posix_memalign((void **)&c->bin,PF_CACHE_LINE,bins*sizeof(struct cluster_bin))!=0) c->bin=NULL;
+    c->used=(int *)malloc(cells*sizeof(int));
+    c->stack=(int *)malloc((cells+1)*sizeof(int));	// +1: see fillCluster()
+    c->centre_x=(double *)malloc((c->gx+c->gy+c->gt)*sizeof(double));
+    if (c->mark==NULL||c->bin==NULL||c->used==NULL||c->stack==NULL||c->centre_x==NULL)
+    {
+        freeClusters(c);
+        return -1;
+    }
+    c->centre_y=c->centre_x+c->gx;
+    c->centre_t=c->centre_y+c->gy;
+    for (int i=0; i<c->gx; i++) c->centre_x[i]=(i+0.5)*bin_xy;
+    for (int i=0; i<c->gy; i++) c->centre_y[i]=(i+0.5)*bin_xy;
+    for (int i=0; i<c->gt; i++) c->centre_t[i]=(i+0.5)*c->bin_theta;
+    c->enabled=1;
+    return 0;
+}
+
+void freeClusters(struct pose_clusters *c)
+{
+    free(c->mark);
+    free(c->bin);
+    free(c->used);
+    free(c->stack);
+    free(c->centre_x);
+    memset(c,0,sizeof(struct pose_clusters));
+}
+
+#define LABEL_NONE -1	// Heavy bin not in a cluster yet
+#define LABEL_LIGHT -2	// Bin too light to be in any
+
+static inline int clampBin(int b, int n)
+{
+    return b<0?0:(b>=n?n-1:b);
+}
+
+static void binParticles(struct pose_clusters *c, const pf_pose *x, const pf_pose *y, const pf_pose *theta, const double *w, int n,
+                         double cut)
+{
+    // Locals, so the stores into the bins don't reload them
+    double inv_xy=1.0/c->bin_xy, inv_t=1.0/c->bin_theta;
+    const double *cx=c->centre_x, *cy=c->centre_y, *ct=c->centre_t;
+    int gx=c->gx, gy=c->gy, gt=c->gt, px=c->px, plane=c->plane;
+    struct cluster_bin *bin=c->bin;
+    struct cluster_mark *mark=c->mark;
+    int *used=c->used;
+    int n_used=0;
+
+    // A new generation marks every bin empty
+    if (++c->generation==0)
+    {
+        memset(mark,0,(size_t)plane*gt*sizeof(struct cluster_mark));
+        c->generation=1;
+    }
+    unsigned int gen=c->generation;
+
+    for (int i=0; i<n; i++)
+    {
+        double wi=w[i];
+        if (!(wi>cut)) continue;
+        int bx=clampBin((int)(x[i]*inv_xy),gx);
+        int by=clampBin((int)(y[i]*inv_xy),gy);
+        int bt=clampBin((int)(theta[i]*inv_t),gt);
+        int b=bt*plane+(by+1)*px+bx+1;
+        struct cluster_bin *s=&bin[b];
+        if (mark[b].stamp!=gen)
+        {
+            mark[b].stamp=gen;
+            mark[b].bx=bx;
+            mark[b].by=by;
+            mark[b].bt=bt;
+            used[n_used++]=b;
+            memset(s,0,sizeof(struct cluster_bin));
+        }
+
+        // Offsets from the bin's centre are at most half a bin (more
+        // only for poses clamped into the border bins)
+        double dx=x[i]-cx[bx], dy=y[i]-cy[by], dt=theta[i]-ct[bt];
+        double wx=wi*dx, wy=wi*dy, wt=wi*dt;
+        s->w+=wi;
+        s->sx+=wx;
+        s->sy+=wy;
+        s->st+=wt;
+        s->sxx+=wx*dx;
+        s->syy+=wy*dy;
+        s->sxy+=wx*dy;
+        s->stt+=wt*dt;
+    }
+    c->n_used=n_used;
+}
+
+static void addBin(struct cluster_bin *acc, const struct cluster_bin *s, double ox, double oy, double ot)
+{
+    // Sums about the bin's centre into sums about a point (ox, oy, ot)
+    // away from it
+    acc->w+=s->w;
+    acc->sx+=s->sx+s->w*ox;
+    acc->sy+=s->sy+s->w*oy;
+    acc->st+=s->st+s->w*ot;
+    acc->sxx+=s->sxx+2.0*ox*s->sx+s->w*ox*ox;
+    acc->syy+=s->syy+2.0*oy*s->sy+s->w*oy*oy;
+    acc->sxy+=s->sxy+ox*s->sy+oy*s->sx+s->w*ox*oy;
+    acc->stt+=s->stt+2.0*ot*s->st+s->w*ot*ot;
+}
+
+static int fillCluster(struct pose_clusters *c, int seed, int label, struct cluster_bin *acc)
+{
+    // Flood fill from the seed through heavy bins, adding their sums
+    // about the seed's centre into acc. Returns the number of bins.
+    struct cluster_mark *mark=c->mark;
+    int *stack=c->stack;
+    unsigned int gen=c->generation;
+    double bin_xy=c->bin_xy, bin_t=c->bin_theta;
+    int px=c->px, plane=c->plane, gt=c->gt;
+    int sbx=mark[seed].bx, sby=mark[seed].by, sbt=mark[seed].bt;
+    int off[10]={-px-1,-px,-px+1,-1,1,px-1,px,px+1};
+    int tests=(gt>2)?10:(gt==2)?9:8;	// Distinct headings around
+    int top=0, bins=0;
+
+    memset(acc,0,sizeof(struct cluster_bin));
+    mark[seed].label=label;
+    stack[top++]=seed;
+    while (top>0)
+    {
+        int b=stack[--top];
+        const struct cluster_mark *mb=&mark[b];
+        addBin(acc,&c->bin[b],(mb->bx-sbx)*bin_xy,(mb->by-sby)*bin_xy,wrap180((mb->bt-sbt)*bin_t));
+        bins++;
+
+        // The heading neighbours, wrapped
+        off[8]=(mb->bt+1<gt)?plane:(1-gt)*plane;
+        off[9]=(mb->bt>0)?-plane:(gt-1)*plane;
+        for (int j=0; j<tests; j++)
+        {
+            // Whether a neighbour joins is close to a coin toss at
+            // the edge of a cloud, so it is pushed without a branch
+            // and only kept if it does
+            int m=b+off[j];
+            int join=(mark[m].stamp==gen)&(mark[m].label==LABEL_NONE);
+            mark[m].label=join?label:mark[m].label;
+            stack[top]=m;
+            top+=join;
+        }
+    }
+    return bins;
+}
+
+static void keepHypothesis(struct pose_clusters *c, const struct pose_hypothesis *h)
+{
+    // Insertion into the k heaviest so far; ties keep the first found
+    int at=c->n_hyp;
+    while (at>0&&c->hyp[at-1].weight<h->weight) at--;
+    if (at>=c->k) return;
+    int last=(c->n_hyp<c->k)?c->n_hyp:c->k-1;
+    memmove(&c->hyp[at+1],&c->hyp[at],(last-at)*sizeof(struct pose_hypothesis));
+    c->hyp[at]=*h;
+    if (c->n_hyp<c->k) c->n_hyp++;
+}
+
+int findClusters(struct pose_clusters *c, const pf_pose *x, const pf_pose *y, const pf_pose *theta, const double *w, int n)
+{
+    c->n_hyp=0;
+    c->clusters=0;
+
+    // With this sonar model most beliefs are many orders of magnitude
+    // below the largest. Those under CLUSTER_FLOOR/n of it weigh less
+    // than one floor all together, so they are not binned: they could
+    // not make a bin heavy, and would only cost time.
+    double total=0.0, largest=0.0;
+    double part[4]={0.0,0.0,0.0,0.0}, top[4]={0.0,0.0,0.0,0.0};
+    int i=0;
+    for (; i+4<=n; i+=4)
+        for (int j=0; j<4; j++)	// Four sums, not one chain of adds
+        {
+            part[j]+=w[i+j];
+            top[j]=(w[i+j]>top[j])?w[i+j]:top[j];
+        }
+    for (; i<n; i++)
+    {
+        part[0]+=w[i];
+        top[0]=(w[i]>top[0])?w[i]:top[0];
+    }
+    for (int j=0; j<4; j++)
+    {
+        total+=part[j];
+        largest=(top[j]>largest)?top[j]:largest;
+    }
+    if (!(total>0.0)) return 0;
+    binParticles(c,x,y,theta,w,n,CLUSTER_FLOOR*largest/n);
+
+    // Bins too light to be part of a cluster are marked as such, so
+    // the flood fill only reads the marks of the neighbours
+    double heaviest=0.0;
+    for (int u=0; u<c->n_used; u++)
+    {
+        double bw=c->bin[c->used[u]].w;
+        if (bw>heaviest) heaviest=bw;
+    }
+    double floor_w=CLUSTER_FLOOR*heaviest;
+    for (int u=0; u<c->n_used; u++)
+    {
+        int b=c->used[u];
+        c->mark[b].label=(c->bin[b].w<floor_w)?LABEL_LIGHT:LABEL_NONE;
+    }
+
+    // Bins are visited in the order they were first touched, which
+    // only depends on the particle order, so the result does too
+    for (int u=0; u<c->n_used; u++)
+    {
+        int seed=c->used[u];
+        if (c->mark[seed].label!=LABEL_NONE) continue;
+
+        struct cluster_bin acc;
+        struct pose_hypothesis h;
+        memset(&h,0,sizeof(h));
+        h.bins=fillCluster(c,seed,c->clusters,&acc);
+        c->clusters++;
+
+        // Mean and covariance about the seed bin's centre
+        double mx=acc.sx/acc.w, my=acc.sy/acc.w, mt=acc.st/acc.w;
+        h.weight=acc.w/total;
+        h.x=(c->mark[seed].bx+0.5)*c->bin_xy+mx;
+        h.y=(c->mark[seed].by+0.5)*c->bin_xy+my;
+        h.theta=wrap360((c->mark[seed].bt+0.5)*c->bin_theta+mt);
+        h.var_x=acc.sxx/acc.w-mx*mx;
+        h.var_y=acc.syy/acc.w-my*my;
+        h.cov_xy=acc.sxy/acc.w-mx*my;
+        h.var_theta=acc.stt/acc.w-mt*mt;
+
+        // A cluster of one pose has no spread, but the subtractions
+        // above can leave a rounding error of either sign
+        if (h.var_x<0.0) h.var_x=0.0;
+        if (h.var_y<0.0) h.var_y=0.0;
+        if (h.var_theta<0.0) h.var_theta=0.0;
+        keepHypothesis(c,&h);
+    }
+    return c->n_hyp;
+}
@@ -0,0 +1,108 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Multi-hypothesis pose estimate: the weighted clusters of the
+  particle set.
+
+  The frame's best particle (FrameEstimate.h) is one sample, and the
+  convergence test only asks whether the whole set is tight. On a
+  symmetric map (map_B.ppm, map_C.ppm) the set splits into a few
+  clouds that agree equally well with the sonar, the best particle
+  jumps from one cloud to another between frames, and neither says
+  where the robot could be.
+
+  findClusters() finds those clouds in O(n):
+
+   1. Every particle adds its belief to a bin of a histogram over
+      (x, y, theta), 'bin_xy' pixels square and 'bin_theta' degrees
+      wide, with the weighted sums and co-moments of its offset from
+      the bin's centre. Bins are generation-stamped, as in
+      KldSampling.c, so no clearing pass is needed, and only the
+      bins touched this frame are visited afterwards.
+   2. Bins holding at least CLUSTER_FLOOR of the heaviest bin's
+      belief are joined by a flood fill to the bins of the same kind
+      around them: the 8 neighbours at the same heading and the
+      same place at the two neighbouring headings (which wrap
+      around). Clouds of particles are compact, so this joins the
+      same bins as all 26 neighbours would, with 10 tests a bin.
+      Lighter bins are the scattered particles of a global search
+      and belong to no cluster.
+   3. The bin sums of each cluster are shifted to its first bin and
+      added, which gives its total belief, mean pose and covariance
+      with no second pass over the particles. Headings are offsets
+      from that bin, wrapped to [-180, 180), as in FrameEstimate.h.
+
+  The k heaviest clusters are kept, heaviest first. Their weights
+  are fractions of the set's belief, so when they add up to nearly 1
+  the set is in k places, and the first is the reported estimate.
+
+  The histogram has sx/bin_xy * sy/bin_xy * 360/bin_theta bins,
+  about 16000 (a megabyte of sums) for the 1015x764 maps with the
+  default 20 pixel, 45 degree bins. A frame only touches the bins
+  its heavy particles are in, a few hundred once the set has
+  gathered, and takes about half a millisecond for 50000 particles;
+  the worst case, a frame where every particle weighs about the same,
+  touches every bin a particle is in and takes about twice that.
+*/
+
+#ifndef __PoseClusters_header
+#define __PoseClusters_header
+
+#include "ParticleStore.h"
+
+#define CLUSTER_FLOOR 1e-3	// Bins lighter than this times the heaviest are left out
+#define CLUSTER_MAX_K 16	// Most hypotheses reported
+
+struct cluster_bin{
+ double w;			// Belief in the bin
+ double sx, sy, st;		// Weighted offsets from the bin's centre
+ double sxx, syy, sxy, stt;	// and their weighted co-moments
+};
+
+struct cluster_mark{
+ unsigned int stamp;		// Generation that last touched the bin
+ int label;			// Its cluster, if stamped this generation
+ int bx, by, bt;		// Its coordinates, if stamped
+};
+
+struct pose_hypothesis{
+ double weight;			// Belief of the cluster
+ double x, y, theta;		// Weighted mean pose (theta in degrees)
+ double var_x, var_y, cov_xy;	// Weighted covariance of the position
+ double var_theta;		// and of the heading, in degrees^2
+ int bins;			// Histogram bins in the cluster
+};
+
+struct pose_clusters{
+ int enabled;
+ int k;				// Hypotheses to keep
+ double bin_xy;			// Bin size in pixels
+ double bin_theta;		// Bin size in degrees (360/gt)
+ int gx, gy, gt;		// Histogram dimensions
+ double *centre_x, *centre_y, *centre_t;	// Bin centres along each axis
+ int px, plane;			// Row and plane of the histogram, with a
+				// border of never stamped bins around x, y
+ struct cluster_mark *mark;	// Stamp and cluster of each bin
+ unsigned int generation;
+ struct cluster_bin *bin;	// Sums of each bin (valid if stamped)
+ int *used;			// Bins touched this generation
+ int n_used;
+ int *stack;			// Flood fill work list
+ int n_hyp;			// Hypotheses found, at most k
+ struct pose_hypothesis hyp[CLUSTER_MAX_K];	// Heaviest first
+ int clusters;			// Clusters found in all
+};
+
+// Set up a histogram for an sx x sy map that reports the k heaviest
+// clusters. Returns 0 on success, -1 if the parameters are invalid or
+// memory could not be allocated.
+int initClusters(struct pose_clusters *c, int sx, int sy, int k, double bin_xy, double bin_theta);
+
+// Release the histogram
+void freeClusters(struct pose_clusters *c);
+
+// Cluster the n poses x[], y[], theta[] with beliefs w[] (which need
+// not add up to 1). Fills c->hyp[] and returns c->n_hyp.
+int findClusters(struct pose_clusters *c, const pf_pose *x, const pf_pose *y, const pf_pose *theta, const double *w, int n);
+
+#endif
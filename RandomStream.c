@@ -0,0 +1,50 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Counter-based random streams. See RandomStream.h
+*/
+
+#include "RandomStream.h"
+
+// Round multipliers and Weyl key increments from Salmon et al.,
+// "Parallel random numbers: as easy as 1, 2, 3" (SC'11)
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0=ctr[0], c1=ctr[1], c2=ctr[2], c3=ctr[3];
+    uint32_t k0=key[0], k1=key[1];
+
+    for (int r=0; r<PHILOX_ROUNDS; r++)
+    {
+        uint64_t p0=(uint64_t)PHILOX_M0*c0;
+        uint64_t p1=(uint64_t)PHILOX_M1*c2;
+        uint32_t n0=(uint32_t)(p1>>32)^c1^k0;
+        uint32_t n2=(uint32_t)(p0>>32)^c3^k1;
+        c1=(uint32_t)p1;
+        c3=(uint32_t)p0;
+        c0=n0;
+        c2=n2;
+        k0+=PHILOX_W0;
+        k1+=PHILOX_W1;
+    }
+    out[0]=c0;
+    out[1]=c1;
+    out[2]=c2;
+    out[3]=c3;
+}
+
+void rngStream(struct rng_stream *s, uint64_t seed, enum rng_purpose purpose, uint32_t step, uint32_t index)
+{
+    s->key[0]=(uint32_t)seed;
+    s->key[1]=(uint32_t)(seed>>32);
+    s->ctr[0]=0;
+    s->ctr[1]=index;
+    s->ctr[2]=step;
+    s->ctr[3]=(uint32_t)purpose;
+    s->left=0;
+}
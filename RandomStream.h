@@ -0,0 +1,78 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Counter-based random streams (Philox4x32-10).
+
+  The filter used to draw from several generators with shared
+  state: drand48() inside move(), GaussianNoise() and initRobot(),
+  rand() seeded from the clock in initParticles(), and one erand48()
+  state per pool worker. What a particle drew depended on which
+  worker happened to move it and on what ran before, so two runs
+  with the same seed but a different number of threads went their
+  separate ways after the first iteration.
+
+  Philox is a keyed bijection on 128-bit counters: the output for
+  a counter depends on nothing but the key and the counter, so a
+  stream can be started anywhere without running the ones before
+  it. Every stream is named by what it is for:
+
+   (seed, purpose, step, index)
+
+  e.g. particle i's motion noise in filter step t is the stream
+  (seed, RNG_MOVE, t, i), whichever thread computes it. A run is
+  then fully determined by its seed, for any number of threads.
+
+  The key is the 64-bit seed, the counter words are the block
+  number within the stream (ctr[0]) and the stream's name (ctr[1]
+  = index, ctr[2] = step, ctr[3] = purpose). Each stream has 2^32
+  blocks of four 32-bit outputs.
+*/
+
+#ifndef __RandomStream_header
+#define __RandomStream_header
+
+#include <stdint.h>
+
+// What a stream is used for (ctr[3])
+enum rng_purpose{
+ RNG_PLACE,			// Robot start pose
+ RNG_INIT,			// Initial particle i
+ RNG_MOVE,			// Particle i's motion in a step
+ RNG_ROBOT,			// Robot motion and sonar in a step
+ RNG_RESAMPLE			// Resampling and injection in a step
+};
+
+struct rng_stream{
+ uint32_t key[2];		// Seed
+ uint32_t ctr[4];		// Next block, and the stream's name
+ uint32_t out[4];		// Current block
+ int left;			// Outputs of 'out' not used yet
+};
+
+// Philox4x32-10 of 'ctr' under 'key'
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]);
+
+// Start stream (purpose, step, index) for 'seed'
+void rngStream(struct rng_stream *s, uint64_t seed, enum rng_purpose purpose, uint32_t step, uint32_t index);
+
+// Next 32 random bits
+static inline uint32_t rngNext32(struct rng_stream *s)
+{
+ if (s->left==0)
+ {
+  philox4x32(s->ctr,s->key,s->out);
+  s->ctr[0]++;
+  s->left=4;
+ }
+ return s->out[4-s->left--];
+}
+
+// Uniform double in [0, 1) with 53 random bits, like erand48() but
+// with a finer grid
+static inline double rngUniform(struct rng_stream *s)
+{
+ uint64_t a=rngNext32(s)>>5, b=rngNext32(s)>>6;
+ return (double)((a<<26)|b)*(1.0/9007199254740992.0);
+}
+
+#endif
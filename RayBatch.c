@@ -0,0 +1,194 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Batched ray casting. See RayBatch.h
+*/
+
+#include "RayBatch.h"
+
+#if defined(__x86_64__)||defined(__i386__)
+#include <immintrin.h>
+#define PF_X86 1
+#endif
+
+#define LANES 8
+
+static void castScalar(const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y, int n, pf_meas *d)
+{
+    double m[PF_MAX_BEAMS];
+    for (int i=0; i<n; i++)
+    {
+        gridCast(g,x[i],y[i],m);
+        for (int k=0; k<g->beams; k++) d[(size_t)i*g->beams+k]=measEncode(m[k]);
+    }
+}
+
+#ifdef PF_X86
+// Lane state that only changes when a lane gets a new beam
+struct lanes{
+ double x0[LANES], y0[LANES];
+ double dx[LANES], dy[LANES];
+ int32_t steps[LANES], skip[LANES];
+ size_t out[LANES];		// Where the lane's reading goes
+};
+
+static inline int startSkip(const struct occupancy_grid *g, double x0, double y0)
+{
+    // Same as gridCast(): steps that can be skipped from the start
+    int x=gridRound(x0), y=gridRound(y0);
+    int s=(x<0||x>=g->sx||y<0||y>=g->sy)?0:g->skip[(size_t)y*g->sx+x];
+    return (s==GRID_WALL)?0:s;
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m128i roundHalf(__m256d v)
+{
+    // gridRound() of four doubles: truncate, then step away from zero
+    // if the dropped fraction is at least one half
+    __m256d t=_mm256_round_pd(v,_MM_FROUND_TO_ZERO|_MM_FROUND_NO_EXC);
+    __m256d f=_mm256_sub_pd(v,t);
+    __m256d one=_mm256_set1_pd(1.0);
+    t=_mm256_add_pd(t,_mm256_and_pd(_mm256_cmp_pd(f,_mm256_set1_pd(0.5),_CMP_GE_OQ),one));
+    t=_mm256_sub_pd(t,_mm256_and_pd(_mm256_cmp_pd(f,_mm256_set1_pd(-0.5),_CMP_LE_OQ),one));
+    return _mm256_cvttpd_epi32(t);
+}
+
+__attribute__((target("avx2,fma")))
+static void castAVX2(const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y, int n, pf_meas *d)
+{
+    struct lanes L;
+    int beams=g->beams;
+    int next_i=0, next_k=0;	// Next beam to hand out
+    unsigned int live=0;	// Lanes with a beam
+
+    // Every lane gets a beam, as long as there are any
+    for (int l=0; l<LANES; l++)
+    {
+        L.steps[l]=0;
+        L.skip[l]=0;
+        L.x0[l]=L.y0[l]=L.dx[l]=L.dy[l]=0.0;
+        if (next_i>=n) continue;
+        L.x0[l]=x[next_i];
+        L.y0[l]=y[next_i];
+        L.dx[l]=g->dx[next_k];
+        L.dy[l]=g->dy[next_k];
+        L.skip[l]=startSkip(g,L.x0[l],L.y0[l]);
+        L.out[l]=(size_t)next_i*beams+next_k;
+        live|=1u<<l;
+        if (++next_k==beams) {next_k=0; next_i++;}
+    }
+
+    const __m256i range=_mm256_set1_epi32(PF_SONAR_RANGE);
+    const __m256i wall=_mm256_set1_epi32(GRID_WALL);
+    const __m256i width=_mm256_set1_epi32(g->sx);
+    const __m256i height=_mm256_set1_epi32(g->sy);
+    const __m256i minus1=_mm256_set1_epi32(-1);
+    const __m256i bytes=_mm256_set1_epi32(0xFF);
+    const int *table=(const int *)g->skip;	// Read as aligned words, see below
+
+    __m256d x0a=_mm256_loadu_pd(L.x0), x0b=_mm256_loadu_pd(L.x0+4);
+    __m256d y0a=_mm256_loadu_pd(L.y0), y0b=_mm256_loadu_pd(L.y0+4);
+    __m256d dxa=_mm256_loadu_pd(L.dx), dxb=_mm256_loadu_pd(L.dx+4);
+    __m256d dya=_mm256_loadu_pd(L.dy), dyb=_mm256_loadu_pd(L.dy+4);
+    __m256i steps=_mm256_loadu_si256((const __m256i *)L.steps);
+    __m256i skip=_mm256_loadu_si256((const __m256i *)L.skip);
+
+    while (live)
+    {
+        // One step of gridCast() in every lane: jump, check the range,
+        // then test the next sample
+        steps=_mm256_add_epi32(steps,skip);
+        __m256i over=_mm256_cmpgt_epi32(steps,_mm256_sub_epi32(range,_mm256_set1_epi32(1)));
+        steps=_mm256_blendv_epi8(_mm256_add_epi32(steps,_mm256_set1_epi32(1)),range,over);
+
+        // Sample = round(direction*steps + start), in the same order
+        // of operations as the scalar code
+        __m256d sa=_mm256_cvtepi32_pd(_mm256_castsi256_si128(steps));
+        __m256d sb=_mm256_cvtepi32_pd(_mm256_extracti128_si256(steps,1));
+        __m256i px=_mm256_set_m128i(roundHalf(_mm256_add_pd(_mm256_mul_pd(dxb,sb),x0b)),
+                                    roundHalf(_mm256_add_pd(_mm256_mul_pd(dxa,sa),x0a)));
+        __m256i py=_mm256_set_m128i(roundHalf(_mm256_add_pd(_mm256_mul_pd(dyb,sb),y0b)),
+                                    roundHalf(_mm256_add_pd(_mm256_mul_pd(dya,sa),y0a)));
+        __m256i inside=_mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(px,minus1),_mm256_cmpgt_epi32(width,px)),
+                                        _mm256_and_si256(_mm256_cmpgt_epi32(py,minus1),_mm256_cmpgt_epi32(height,py)));
+        __m256i read=_mm256_andnot_si256(over,inside);
+
+        // Step table entries of the samples still on the map. Bytes
+        // are gathered as the aligned 32-bit word holding them, which
+        // is inside the table's padding (see gridSkipBytes()).
+        __m256i idx=_mm256_add_epi32(_mm256_mullo_epi32(py,width),px);
+        __m256i word=_mm256_mask_i32gather_epi32(_mm256_setzero_si256(),table,_mm256_srli_epi32(idx,2),read,4);
+        skip=_mm256_and_si256(_mm256_srlv_epi32(word,_mm256_slli_epi32(_mm256_and_si256(idx,_mm256_set1_epi32(3)),3)),bytes);
+
+        // Stopped: out of range, off the map, on a wall, or at the
+        // range after this step
+        __m256i stop=_mm256_or_si256(_mm256_andnot_si256(read,minus1),
+                                     _mm256_or_si256(_mm256_cmpeq_epi32(skip,wall),_mm256_cmpgt_epi32(steps,_mm256_sub_epi32(range,_mm256_set1_epi32(1)))));
+        unsigned int done=(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(stop))&live;
+        if (!done) continue;
+
+        // Write the finished readings and refill those lanes
+        _mm256_storeu_si256((__m256i *)L.steps,steps);
+        _mm256_storeu_si256((__m256i *)L.skip,skip);
+        while (done)
+        {
+            int l=__builtin_ctz(done);
+            done&=done-1;
+            d[L.out[l]]=measEncode(L.steps[l]);
+            if (next_i>=n)
+            {
+                live&=~(1u<<l);
+                continue;
+            }
+            L.x0[l]=x[next_i];
+            L.y0[l]=y[next_i];
+            L.dx[l]=g->dx[next_k];
+            L.dy[l]=g->dy[next_k];
+            L.steps[l]=0;
+            L.skip[l]=startSkip(g,L.x0[l],L.y0[l]);
+            L.out[l]=(size_t)next_i*beams+next_k;
+            if (++next_k==beams) {next_k=0; next_i++;}
+        }
+        x0a=_mm256_loadu_pd(L.x0); x0b=_mm256_loadu_pd(L.x0+4);
+        y0a=_mm256_loadu_pd(L.y0); y0b=_mm256_loadu_pd(L.y0+4);
+        dxa=_mm256_loadu_pd(L.dx); dxb=_mm256_loadu_pd(L.dx+4);
+        dya=_mm256_loadu_pd(L.dy); dyb=_mm256_loadu_pd(L.dy+4);
+        steps=_mm256_loadu_si256((const __m256i *)L.steps);
+        skip=_mm256_loadu_si256((const __m256i *)L.skip);
+    }
+}
+#endif
+
+typedef void (*cast_fn)(const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y, int n, pf_meas *d);
+
+static cast_fn castKernel;
+static const char *kernelName;
+
+static void pickKernel(void)
+{
+    // Decided once, on first use
+    if (castKernel!=NULL) return;
+#ifdef PF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernelName="avx2";
+        castKernel=castAVX2;
+        return;
+    }
+#endif
+    kernelName="scalar";
+    castKernel=castScalar;
+}
+
+void gridCastBatch(const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y, int n, pf_meas *d)
+{
+    pickKernel();
+    castKernel(g,x,y,n,d);
+}
+
+const char *rayBatchKernel(void)
+{
+    pickKernel();
+    return kernelName;
+}
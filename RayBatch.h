@@ -0,0 +1,44 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Batched ray casting.
+
+  gridCast() marches one beam of one particle at a time: a loop of
+  a few steps with a data-dependent exit and a table lookup per
+  step, so the CPU spends most of it waiting on branches and loads.
+
+  gridCastBatch() casts the beams of a whole set of poses in 8
+  lanes at once (AVX2). Every lane runs the same march as gridCast()
+  (same rounded samples, same step table jumps, same stopping
+  rules), so the readings are identical:
+
+   - The step count of each lane is an integer, and the sample is
+     the rounded pose + direction * steps, computed in double
+     precision exactly as the scalar code does.
+   - The step table (OccupancyGrid.h) entries of all 8 samples are
+     fetched with one masked gather; lanes that left the map don't
+     read.
+   - A lane that stops (wall, map border or sonar range) writes its
+     reading and is refilled with the next beam right away, so the
+     lanes stay busy even though beams take different numbers of
+     steps.
+
+  Beams are taken in the order of the output matrix, so a particle's
+  beams run side by side and share the cache lines around it.
+  Machines without AVX2 use gridCast() on each pose.
+*/
+
+#ifndef __RayBatch_header
+#define __RayBatch_header
+
+#include "OccupancyGrid.h"
+
+// Ground truth readings for n poses (x[i], y[i]) along the grid's
+// beams: d[i*g->beams+k] gets beam k of pose i, the same as
+// gridCast(g,x[i],y[i],...) would return.
+void gridCastBatch(const struct occupancy_grid *g, const pf_pose *x, const pf_pose *y, int n, pf_meas *d);
+
+// Name of the kernel in use ("avx2" or "scalar")
+const char *rayBatchKernel(void);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Precomputed ray-cast distance table. See RayTable.h
+*/
+
+#include "RayTable.h"
+#include <pthread.h>
+#include <unistd.h>
+
+struct table_job{
+ struct ray_table *t;
+ const struct occupancy_grid *g;
+ int row0,row1;			// Table rows [row0, row1) for this thread
+};
+
+static void *buildRows(void *arg)
+{
+    struct table_job *job=(struct table_job *)arg;
+    struct ray_table *t=job->t;
+    struct particle p;
+
+    memset(&p,0,sizeof(p));
+    for (int cy=job->row0; cy<job->row1; cy++)
+    {
+        for (int cx=0; cx<t->tx; cx++)
+        {
+            unsigned char *d=t->dist+((size_t)cy*t->tx+cx)*PF_BEAMS;
+            p.x=cx*t->stride;
+            p.y=cy*t->stride;
+            if (p.x>t->sx-1) p.x=t->sx-1;
+            if (p.y>t->sy-1) p.y=t->sy-1;
+
+            // Sample points over walls are never looked up by a valid
+            // particle, skip the ray casting for them.
+            if (gridHit(job->g,&p))
+            {
+                memset(d,1,PF_BEAMS);
+                continue;
+            }
+            gridGroundTruth(job->g,&p);
+            for (int k=0; k<PF_BEAMS; k++) d[k]=(unsigned char)p.measureD[k];
+        }
+    }
+    return NULL;
+}
+
+int buildRayTable(struct ray_table *t, const struct occupancy_grid *g, size_t budget, int n_threads)
+{
+    int sx=g->sx, sy=g->sy;
+
+    memset(t,0,sizeof(struct ray_table));
+
+    // Find the finest sample spacing that fits the memory budget
+    int stride=1;
+    size_t bytes;
+    while (1)
+    {
+        int tx=(sx+stride-1)/stride+1;
+        int ty=(sy+stride-1)/stride+1;
+        if (stride==1) {tx=sx; ty=sy;}
+        bytes=(size_t)tx*ty*PF_BEAMS;
+        if (bytes<=budget) {t->tx=tx; t->ty=ty; break;}
+        if (++stride>16) return -1;	// Too coarse to be useful
+    }
+
+    t->dist=(unsigned char *)malloc(bytes);
+    if (t->dist==NULL) return -1;
+    t->sx=sx;
+    t->sy=sy;
+    t->stride=stride;
+
+    if (n_threads<=0) n_threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads<1) n_threads=1;
+    if (n_threads>t->ty) n_threads=t->ty;
+
+    pthread_t *tid=(pthread_t *)calloc(n_threads,sizeof(pthread_t));
+    struct table_job *jobs=(struct table_job *)calloc(n_threads,sizeof(struct table_job));
+    if (tid==NULL||jobs==NULL)
+    {
+        free(tid);
+        free(jobs);
+        freeRayTable(t);
+        return -1;
+    }
+
+    for (int i=0; i<n_threads; i++)
+    {
+        jobs[i].t=t;
+        jobs[i].g=g;
+        jobs[i].row0=(int)((long)t->ty*i/n_threads);
+        jobs[i].row1=(int)((long)t->ty*(i+1)/n_threads);
+        if (pthread_create(&tid[i],NULL,buildRows,&jobs[i])!=0)
+        {
+            buildRows(&jobs[i]);	// Could not spawn, do it here
+            tid[i]=0;
+        }
+    }
+    for (int i=0; i<n_threads; i++)
+        if (tid[i]) pthread_join(tid[i],NULL);
+
+    free(tid);
+    free(jobs);
+    return 0;
+}
+
+void freeRayTable(struct ray_table *t)
+{
+    free(t->dist);
+    memset(t,0,sizeof(struct ray_table));
+}
@@ -0,0 +1,128 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Resampling schemes. See Resample.h
+*/
+
+#include "Resample.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const char *scheme_names[]={"naive","multinomial","systematic","stratified","residual"};
+
+static void resampleNaive(const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    for (int i=0; i<m; i++)
+    {
+        double cumulative_prob=0.0;
+        double r=rngUniform(rng);
+        int j;
+        for (j=0; j<n-1; j++)
+        {
+            cumulative_prob+=w[j];
+            if (cumulative_prob>=r) break;
+        }
+        idx[i]=j;
+    }
+}
+
+// Walk the cumulative weights once, assigning each of the m pointers
+// u[0] <= u[1] <= ... (produced by next()) to the particle whose
+// cumulative weight interval contains it.
+#define SWEEP(next) \
+    do { \
+        double c=w[0]; \
+        int j=0; \
+        for (int i=0; i<m; i++) \
+        { \
+            double ptr=(next); \
+            while (ptr>c&&j<n-1) c+=w[++j]; \
+            idx[i]=j; \
+        } \
+    } while (0)
+
+static void resampleMultinomial(const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    // Sorted uniforms: normalized partial sums of m+1 exponentials.
+    // The generator is rewound so the sweep replays the same draws
+    // that were added up for the total.
+    struct rng_stream start=*rng;
+    double total=0.0;
+    for (int i=0; i<=m; i++) total-=log(1.0-rngUniform(rng));
+    *rng=start;
+
+    double u=0.0;
+    SWEEP((u-=log(1.0-rngUniform(rng))/total, u));
+    rngUniform(rng);			// Skip the last exponential
+}
+
+static void resampleSystematic(const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    double step=1.0/m;
+    double u0=rngUniform(rng)*step;
+    SWEEP(u0+i*step);
+}
+
+static void resampleStratified(const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    double step=1.0/m;
+    SWEEP((i+rngUniform(rng))*step);
+}
+
+static void resampleResidual(const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    // First pass: how many draws the deterministic part leaves over,
+    // and the total of the residual weights m*w[j]-floor(m*w[j])
+    int r=m;
+    double leftover=0.0;
+    for (int j=0; j<n; j++)
+    {
+        double f=floor(m*w[j]);
+        r-=(int)f;
+        leftover+=m*w[j]-f;
+    }
+    if (r<0) r=0;
+
+    // Second pass: floor(m*w[j]) copies of particle j, plus the
+    // systematic draws over the residual weights that fall in j's
+    // interval. Output stays in increasing order.
+    double step=(r>0)?leftover/r:0.0;
+    double u=rngUniform(rng)*step;
+    double c=0.0;
+    int k=0;
+    for (int j=0; j<n&&k<m; j++)
+    {
+        int copies=(int)floor(m*w[j]);
+        c+=m*w[j]-copies;
+        while (k<m&&copies-->0) idx[k++]=j;
+        while (k<m&&r>0&&u<c) {idx[k++]=j; u+=step;}
+    }
+    while (k<m) idx[k++]=n-1;	// Rounding left a pointer past the end
+}
+
+void resampleIndices(enum resample_scheme scheme, const double *w, int n, int *idx, int m, struct rng_stream *rng)
+{
+    if (n<=0||m<=0) return;
+    switch (scheme)
+    {
+        case RESAMPLE_NAIVE: resampleNaive(w,n,idx,m,rng); break;
+        case RESAMPLE_MULTINOMIAL: resampleMultinomial(w,n,idx,m,rng); break;
+        case RESAMPLE_STRATIFIED: resampleStratified(w,n,idx,m,rng); break;
+        case RESAMPLE_RESIDUAL: resampleResidual(w,n,idx,m,rng); break;
+        case RESAMPLE_SYSTEMATIC:
+        default: resampleSystematic(w,n,idx,m,rng); break;
+    }
+}
+
+int resampleSchemeFromName(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(scheme_names)/sizeof(scheme_names[0])); i++)
+        if (!strcmp(name,scheme_names[i])) return i;
+    return -1;
+}
+
+const char *resampleSchemeName(enum resample_scheme scheme)
+{
+    return scheme_names[scheme];
+}
@@ -0,0 +1,48 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Resampling schemes.
+
+  Each scheme draws 'm' parent indices from a set of 'n' particles
+  with normalized weights w[], writing them to idx[] in increasing
+  order. All but RESAMPLE_NAIVE make a single O(n+m) sweep over the
+  cumulative weights:
+
+   multinomial - m independent draws. The sorted uniforms are
+                 generated directly (exponential spacings), so no
+                 search or sort is needed.
+   systematic  - one uniform offset, then m evenly spaced pointers
+                 (low-variance resampling). The default.
+   stratified  - one uniform draw inside each of m equal strata.
+   residual    - floor(m*w[i]) copies of each particle, the rest
+                 drawn systematically from the leftover weights.
+
+  RESAMPLE_NAIVE is the original algorithm: a fresh uniform per
+  draw and a linear scan from the first particle each time, i.e.
+  O(n*m). It is kept for comparison only.
+*/
+
+#ifndef __Resample_header
+#define __Resample_header
+
+#include "RandomStream.h"
+
+enum resample_scheme{
+ RESAMPLE_NAIVE,
+ RESAMPLE_MULTINOMIAL,
+ RESAMPLE_SYSTEMATIC,
+ RESAMPLE_STRATIFIED,
+ RESAMPLE_RESIDUAL
+};
+
+// Draw m parent indices into idx[] according to w[0..n-1] (which
+// must sum to 1). Random numbers come from 'rng'.
+void resampleIndices(enum resample_scheme scheme, const double *w, int n, int *idx, int m, struct rng_stream *rng);
+
+// Scheme from its name ("systematic", ...), or -1 if unknown
+int resampleSchemeFromName(const char *name);
+
+// Name of a scheme
+const char *resampleSchemeName(enum resample_scheme scheme);
+
+#endif
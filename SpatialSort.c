@@ -0,0 +1,164 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Spatial ordering of the particle set. See SpatialSort.h
+*/
+
+#include "SpatialSort.h"
+
+#define RADIX_BITS 11
+#define RADIX_SIZE (1<<RADIX_BITS)
+
+static const char *curve_names[]={"none","morton","hilbert"};
+
+static uint32_t spreadBits(uint32_t v)
+{
+    // Bit i of v to bit 2i (v has at most 16 bits)
+    v&=0xFFFF;
+    v=(v|(v<<8))&0x00FF00FF;
+    v=(v|(v<<4))&0x0F0F0F0F;
+    v=(v|(v<<2))&0x33333333;
+    v=(v|(v<<1))&0x55555555;
+    return v;
+}
+
+static uint32_t hilbertKey(int bits, uint32_t x, uint32_t y)
+{
+    // Distance along the Hilbert curve of a 2^bits square
+    uint32_t n=(uint32_t)1<<bits, d=0;
+    for (uint32_t q=n>>1; q>0; q>>=1)
+    {
+        uint32_t rx=(x&q)!=0, ry=(y&q)!=0;
+        d+=q*q*((3*rx)^ry);
+        if (ry==0)
+        {
+            if (rx==1)
+            {
+                x=n-1-x;
+                y=n-1-y;
+            }
+            uint32_t t=x;
+            x=y;
+            y=t;
+        }
+    }
+    return d;
+}
+
+int initSpatialSort(struct spatial_sort *s, enum sort_curve curve, int sx, int sy)
+{
+    memset(s,0,sizeof(struct spatial_sort));
+    s->bits=1;
+    while ((1<<s->bits)<sx||(1<<s->bits)<sy) s->bits++;
+    if (s->bits>16) return -1;
+    s->curve=curve;
+    s->sx=sx;
+    s->sy=sy;
+    return 0;
+}
+
+void freeSpatialSort(struct spatial_sort *s)
+{
+    for (int b=0; b<2; b++)
+    {
+        free(s->key[b]);
+        free(s->idx[b]);
+    }
+    freeStore(&s->tmp);
+    memset(s,0,sizeof(struct spatial_sort));
+}
+
+static int growBuffers(struct spatial_sort *s, const struct particle_store *p)
+{
+    if (s->cap>=p->n&&s->tmp.cap>=p->n&&s->tmp.beams==p->beams) return 0;
+
+    // Sized to the set's capacity, so the store swapped back into
+    // p can hold as many particles as the one it replaces
+    int cap=p->cap;
+    for (int b=0; b<2; b++)
+    {
+        free(s->key[b]);
+        free(s->idx[b]);
+        s->key[b]=(uint32_t *)malloc(cap*sizeof(uint32_t));
+        s->idx[b]=(int *)malloc(cap*sizeof(int));
+    }
+    freeStore(&s->tmp);
+    s->cap=0;
+    if (s->key[0]==NULL||s->key[1]==NULL||s->idx[0]==NULL||s->idx[1]==NULL||initStore(&s->tmp,cap,p->beams)!=0) return -1;
+    s->cap=cap;
+    return 0;
+}
+
+int sortParticles(struct spatial_sort *s, struct particle_store *p)
+{
+    int n=p->n;
+    if (s->curve==SORT_NONE||n<2) return 0;
+    if (growBuffers(s,p)!=0) return -1;
+
+    // Curve index of each particle's pixel
+    uint32_t *key=s->key[0];
+    int *idx=s->idx[0];
+    for (int i=0; i<n; i++)
+    {
+        int x=(int)p->x[i], y=(int)p->y[i];
+        x=x<0?0:(x>=s->sx?s->sx-1:x);
+        y=y<0?0:(y>=s->sy?s->sy-1:y);
+        key[i]=(s->curve==SORT_MORTON)?spreadBits(x)|(spreadBits(y)<<1):hilbertKey(s->bits,x,y);
+        idx[i]=i;
+    }
+
+    // Stable LSD radix sort, one counting pass per digit
+    int key_bits=2*s->bits, cur=0;
+    int count[RADIX_SIZE];
+    for (int shift=0; shift<key_bits; shift+=RADIX_BITS)
+    {
+        const uint32_t *k_in=s->key[cur];
+        const int *i_in=s->idx[cur];
+        uint32_t *k_out=s->key[cur^1];
+        int *i_out=s->idx[cur^1];
+
+        memset(count,0,sizeof(count));
+        for (int i=0; i<n; i++) count[(k_in[i]>>shift)&(RADIX_SIZE-1)]++;
+        int sum=0;
+        for (int d=0; d<RADIX_SIZE; d++)
+        {
+            int c=count[d];
+            count[d]=sum;
+            sum+=c;
+        }
+        for (int i=0; i<n; i++)
+        {
+            int pos=count[(k_in[i]>>shift)&(RADIX_SIZE-1)]++;
+            k_out[pos]=k_in[i];
+            i_out[pos]=i_in[i];
+        }
+        cur^=1;
+    }
+
+    // Gather the set in key order and swap it into place
+    const int *order=s->idx[cur];
+    struct particle_store *t=&s->tmp;
+    for (int i=0; i<n; i++)
+    {
+        int j=order[i];
+        t->x[i]=p->x[j];
+        t->y[i]=p->y[j];
+        t->theta[i]=p->theta[j];
+        t->prob[i]=p->prob[j];
+    }
+    t->n=n;
+    swapStore(p,t);
+    return 0;
+}
+
+int sortCurveFromName(const char *name)
+{
+    for (int i=0; i<(int)(sizeof(curve_names)/sizeof(curve_names[0])); i++)
+        if (!strcmp(name,curve_names[i])) return i;
+    return -1;
+}
+
+const char *sortCurveName(enum sort_curve curve)
+{
+    return curve_names[curve];
+}
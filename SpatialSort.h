@@ -0,0 +1,68 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Spatial ordering of the particle set.
+
+  resample() writes the new set in the order of the old one, and
+  random injection drops particles anywhere, so neighbours in the
+  arrays are not neighbours on the map. Step 1 then ray-casts
+  particles in an order that jumps all over the occupancy grid and
+  its step table, and every particle starts on cold cache lines.
+
+  sortParticles() reorders the set along a space-filling curve:
+  each particle gets the curve index of its pixel as a key, and a
+  stable LSD radix sort (11-bit digits: two passes for maps up to
+  2048 pixels a side, three beyond) orders the keys in O(N). Particles
+  close on the map then sit close in memory, so consecutive ray
+  casts reuse the same map tiles.
+
+   SORT_MORTON   - Z-order, bits of x and y interleaved. Cheapest
+                   key.
+   SORT_HILBERT  - Hilbert curve, no long jumps between quadrants.
+
+  The reorder changes which random stream each particle draws from
+  (streams are named by index, see RandomStream.h), so a run with
+  sorting differs from one without, but is still reproducible.
+*/
+
+#ifndef __SpatialSort_header
+#define __SpatialSort_header
+
+#include <stdint.h>
+#include "ParticleStore.h"
+
+enum sort_curve{
+ SORT_NONE,
+ SORT_MORTON,
+ SORT_HILBERT
+};
+
+struct spatial_sort{
+ enum sort_curve curve;
+ int bits;			// Bits per coordinate
+ int sx,sy;
+ int cap;			// Particles the buffers can hold
+ uint32_t *key[2];		// Radix sort keys and their ping-pong copy
+ int *idx[2];			// Particle index of each key
+ struct particle_store tmp;	// Reordered set, swapped into place
+};
+
+// Set up ordering along 'curve' for an sx x sy map. Returns 0 on
+// success, -1 if the map is too big for 32-bit keys.
+int initSpatialSort(struct spatial_sort *s, enum sort_curve curve, int sx, int sy);
+
+// Release the buffers
+void freeSpatialSort(struct spatial_sort *s);
+
+// Reorder particles p[0..p->n-1] along the curve (measurements are
+// not kept). Returns 0 on success, -1 if out of memory (the set is
+// left as it was).
+int sortParticles(struct spatial_sort *s, struct particle_store *p);
+
+// Curve from its name ("morton", "hilbert", "none"), or -1 if unknown
+int sortCurveFromName(const char *name);
+
+// Name of a curve
+const char *sortCurveName(enum sort_curve curve);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Persistent worker pool. See ThreadPool.h
+*/
+
+#include "ThreadPool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define POOL_MAX_CHUNKS 4096	// Partial results kept on the stack by reductions
+
+static int takeChunk(struct pool_range *r, int steal)
+{
+    // Owners take from the front of their range, thieves from the back
+    int c=-1;
+    pthread_mutex_lock(&r->lock);
+    if (r->next<r->end) c=steal?--r->end:r->next++;
+    pthread_mutex_unlock(&r->lock);
+    return c;
+}
+
+static void runChunks(struct thread_pool *pool, int worker)
+{
+    int c;
+    while ((c=takeChunk(&pool->range[worker],0))>=0)
+    {
+        int begin=c*pool->chunk;
+        int end=begin+pool->chunk<pool->n?begin+pool->chunk:pool->n;
+        pool->task(pool->arg,begin,end,c,worker);
+    }
+
+    // Own range exhausted, help the others
+    for (int k=1; k<pool->n_workers; k++)
+    {
+        int victim=(worker+k)%pool->n_workers;
+        while ((c=takeChunk(&pool->range[victim],1))>=0)
+        {
+            int begin=c*pool->chunk;
+            int end=begin+pool->chunk<pool->n?begin+pool->chunk:pool->n;
+            pool->task(pool->arg,begin,end,c,worker);
+        }
+    }
+}
+
+struct worker_start{
+ struct thread_pool *pool;
+ int worker;
+};
+
+static void *workerMain(void *arg)
+{
+    struct worker_start *ws=(struct worker_start *)arg;
+    struct thread_pool *pool=ws->pool;
+    int worker=ws->worker;
+    unsigned long seen=0;
+    free(ws);
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->quit&&pool->generation==seen)
+            pthread_cond_wait(&pool->wake,&pool->lock);
+        if (pool->quit) break;
+        seen=pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runChunks(pool,worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy==0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct thread_pool *createPool(int n_workers)
+{
+    if (n_workers<=0) n_workers=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_workers<1) n_workers=1;
+
+    struct thread_pool *pool=(struct thread_pool *)calloc(1,sizeof(struct thread_pool));
+    if (pool==NULL) return NULL;
+    pool->tid=(pthread_t *)calloc(n_workers,sizeof(pthread_t));
+    pool->range=(struct pool_range *)calloc(n_workers,sizeof(struct pool_range));
+    if (pool->tid==NULL||pool->range==NULL)
+    {
+        free(pool->tid);
+        free(pool->range);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock,NULL);
+    pthread_cond_init(&pool->wake,NULL);
+    pthread_cond_init(&pool->done,NULL);
+    for (int i=0; i<n_workers; i++) pthread_mutex_init(&pool->range[i].lock,NULL);
+
+    // Worker 0 is whoever calls poolRun()
+    pool->n_workers=1;
+    for (int i=1; i<n_workers; i++)
+    {
+        struct worker_start *ws=(struct worker_start *)malloc(sizeof(struct worker_start));
+        if (ws==NULL) break;
+        ws->pool=pool;
+        ws->worker=i;
+        if (pthread_create(&pool->tid[i],NULL,workerMain,ws)!=0)
+        {
+            free(ws);
+            break;
+        }
+        pool->n_workers++;
+    }
+    return pool;
+}
+
+void destroyPool(struct thread_pool *pool)
+{
+    if (pool==NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit=1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=1; i<pool->n_workers; i++) pthread_join(pool->tid[i],NULL);
+
+    for (int i=0; i<pool->n_workers; i++) pthread_mutex_destroy(&pool->range[i].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->tid);
+    free(pool->range);
+    free(pool);
+}
+
+int poolWorkers(struct thread_pool *pool)
+{
+    return pool==NULL?1:pool->n_workers;
+}
+
+int poolChunkSize(struct thread_pool *pool, int n, int min_chunk)
+{
+    int chunk=n/(poolWorkers(pool)*8);
+    if (chunk<min_chunk) chunk=min_chunk;
+    if (chunk<1) chunk=1;
+    return chunk;
+}
+
+void poolRun(struct thread_pool *pool, pool_task task, void *arg, int n, int chunk)
+{
+    if (n<=0) return;
+    if (chunk<1) chunk=1;
+    int n_chunks=poolChunks(n,chunk);
+
+    if (pool==NULL||pool->n_workers==1||n_chunks==1)
+    {
+        for (int c=0; c<n_chunks; c++)
+        {
+            int begin=c*chunk;
+            int end=begin+chunk<n?begin+chunk:n;
+            task(arg,begin,end,c,0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task=task;
+    pool->arg=arg;
+    pool->n=n;
+    pool->chunk=chunk;
+    for (int i=0; i<pool->n_workers; i++)
+    {
+        pool->range[i].next=(int)((long)n_chunks*i/pool->n_workers);
+        pool->range[i].end=(int)((long)n_chunks*(i+1)/pool->n_workers);
+    }
+    pool->busy=pool->n_workers-1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    runChunks(pool,0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy>0) pthread_cond_wait(&pool->done,&pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+struct sum_job{
+ const double *v;
+ double *partial;
+};
+
+static void sumChunk(void *arg, int begin, int end, int chunk, int worker)
+{
+    struct sum_job *job=(struct sum_job *)arg;
+    double s=0.0;
+    for (int i=begin; i<end; i++) s+=job->v[i];
+    job->partial[chunk]=s;
+}
+
+static int reduceChunkSize(int n)
+{
+    // Fixed chunking so the reduction order never depends on the pool
+    int chunk=1024;
+    if (poolChunks(n,chunk)>POOL_MAX_CHUNKS) chunk=(n+POOL_MAX_CHUNKS-1)/POOL_MAX_CHUNKS;
+    return chunk;
+}
+
+double poolSum(struct thread_pool *pool, const double *v, int n)
+{
+    double partial[POOL_MAX_CHUNKS];
+    struct sum_job job;
+
+    int chunk=reduceChunkSize(n);
+    job.v=v;
+    job.partial=partial;
+    poolRun(pool,sumChunk,&job,n,chunk);
+
+    double s=0.0;
+    for (int c=0; c<poolChunks(n,chunk); c++) s+=partial[c];
+    return s;
+}
+
+static void maxChunk(void *arg, int begin, int end, int chunk, int worker)
+{
+    struct sum_job *job=(struct sum_job *)arg;
+    double m=-HUGE_VAL;
+    for (int i=begin; i<end; i++) if (job->v[i]>m) m=job->v[i];
+    job->partial[chunk]=m;
+}
+
+double poolMax(struct thread_pool *pool, const double *v, int n)
+{
+    double partial[POOL_MAX_CHUNKS];
+    struct sum_job job;
+
+    int chunk=reduceChunkSize(n);
+    job.v=v;
+    job.partial=partial;
+    poolRun(pool,maxChunk,&job,n,chunk);
+
+    double m=-HUGE_VAL;
+    for (int c=0; c<poolChunks(n,chunk); c++) if (partial[c]>m) m=partial[c];
+    return m;
+}
@@ -0,0 +1,86 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Persistent worker pool for the per-particle filter stages.
+
+  The pool is created once and its threads sleep between jobs.
+  poolRun() splits the index range [0, n) into fixed size chunks
+  and deals them out evenly to the workers (the calling thread is
+  worker 0). A worker that runs out of chunks steals from the end
+  of another worker's range, so chunks that take longer than
+  others (e.g. many wall-bounce retries) do not leave the rest of
+  the pool idle.
+
+  Tasks receive the chunk's index range plus the chunk number and
+  worker id. Per-chunk partial results written to slot 'chunk' and
+  combined in chunk order give the same answer no matter how many
+  workers there are or who ran which chunk (see poolSum()).
+
+  A NULL pool is valid everywhere and runs the job on the calling
+  thread.
+*/
+
+#ifndef __ThreadPool_header
+#define __ThreadPool_header
+
+#include <pthread.h>
+
+// Process indices [begin, end) of chunk number 'chunk' on worker 'worker'
+typedef void (*pool_task)(void *arg, int begin, int end, int chunk, int worker);
+
+struct pool_range{
+ pthread_mutex_t lock;
+ int next;			// First chunk not yet taken
+ int end;			// One past the last chunk owned
+ char pad[64];			// Keep ranges on separate cache lines
+};
+
+struct thread_pool{
+ int n_workers;			// Including the calling thread
+ pthread_t *tid;
+ struct pool_range *range;	// One per worker
+ pthread_mutex_t lock;
+ pthread_cond_t wake;
+ pthread_cond_t done;
+ unsigned long generation;	// Bumped for every job
+ int busy;			// Workers still running the current job
+ int quit;
+ // Current job
+ pool_task task;
+ void *arg;
+ int n;
+ int chunk;
+};
+
+// Create a pool with 'n_workers' workers (<=0 means one per online
+// CPU). Returns NULL if it could not be created.
+struct thread_pool *createPool(int n_workers);
+
+// Stop the workers and release the pool
+void destroyPool(struct thread_pool *pool);
+
+// Number of workers (1 for a NULL pool)
+int poolWorkers(struct thread_pool *pool);
+
+// Number of chunks poolRun() uses for n items of size 'chunk'
+static inline int poolChunks(int n, int chunk)
+{
+ return (n+chunk-1)/chunk;
+}
+
+// Pick a chunk size for n items that gives each worker several
+// chunks to balance with, but no less than 'min_chunk' items each
+int poolChunkSize(struct thread_pool *pool, int n, int min_chunk);
+
+// Run task over [0, n) in chunks of 'chunk' items and wait for it
+// to finish. Not re-entrant: only one job may run on a pool at a time.
+void poolRun(struct thread_pool *pool, pool_task task, void *arg, int n, int chunk);
+
+// Parallel sum of v[0..n-1]. The result does not depend on the
+// number of workers.
+double poolSum(struct thread_pool *pool, const double *v, int n);
+
+// Parallel maximum of v[0..n-1] (-HUGE_VAL for n<=0)
+double poolMax(struct thread_pool *pool, const double *v, int n);
+
+#endif
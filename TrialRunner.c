@@ -0,0 +1,214 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Monte Carlo trial runner. See TrialRunner.h
+*/
+
+#include "ParticleFilters.h"
+#include "TrialRunner.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double x=*(const double *)a, y=*(const double *)b;
+    return (x>y)-(x<y);
+}
+
+static double percentile(double *v, int n, double q)
+{
+    // v[] must be sorted
+    if (n<=0) return 0.0;
+    int i=(int)ceil(q*n)-1;
+    return v[i<0?0:i];
+}
+
+static void runTrial(int t, long seed, int iters, int threads, int start_particles, struct trial_result *r)
+{
+    // Runs in the child process: everything set up here dies with it
+    memset(r,0,sizeof(struct trial_result));
+    r->trial=t;
+    r->seed=seed;
+    r->localized_iter=-1;
+
+    rngSeed=(uint64_t)seed;
+    filterSteps=0;
+    pool=createPool(threads);
+
+    iterations=1;
+    localizationAchieved=false;
+    n_particles=start_particles;
+    struct rng_stream rng;
+    rngStream(&rng,rngSeed,RNG_PLACE,0,0);
+    robot=gridInitRobot(&occGrid,&rng);
+    if (robot==NULL) return;
+    senseRobot(&rng);
+    memset(&particles,0,sizeof(particles));
+    initParticles();
+
+    double start=seconds();
+    for (int it=1; it<=iters; it++)
+    {
+        filterStep();
+        if (r->localized_iter<0&&localizationAchieved)
+        {
+            r->localized_iter=it;
+            r->localize_s=seconds()-start;
+        }
+    }
+    double total=seconds()-start;
+
+    double ex,ey,et;
+    reportedPose(&ex,&ey,&et);
+    r->final_error=poseError(ex,ey);
+    r->fps=iters/total;
+    r->particles=particles.n;
+    r->ok=1;
+}
+
+static pid_t startTrial(int t, long seed, int iters, int threads, int start_particles, int fd)
+{
+    fflush(NULL);	// Don't let the child flush our buffers too
+    pid_t pid=fork();
+    if (pid!=0) return pid;
+
+    struct trial_result r;
+    runTrial(t,seed,iters,threads,start_particles,&r);
+    // One result is far below PIPE_BUF, so the write is atomic. The
+    // exit status only says whether it was written: the parent reads
+    // one result for every clean exit, and r.ok says how the trial went
+    if (write(fd,&r,sizeof(r))!=sizeof(r)) _exit(1);
+    _exit(0);
+}
+
+int runTrials(int trials, int jobs, int iters, long seed, int threads)
+{
+    int fd[2];
+    int start_particles=n_particles;
+
+    if (jobs<=0) jobs=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs<1) jobs=1;
+    if (threads<1) threads=1;
+
+    struct trial_result *res=(struct trial_result *)calloc(trials,sizeof(struct trial_result));
+    pid_t *pid=(pid_t *)calloc(trials,sizeof(pid_t));
+    double *v=(double *)calloc(trials,sizeof(double));
+    if (res==NULL||pid==NULL||v==NULL||pipe(fd)!=0)
+    {
+        fprintf(stderr,"Unable to set up trials\n");
+        free(res);
+        free(pid);
+        free(v);
+        return 0;
+    }
+
+    fprintf(stderr,"Running %d trials of %d iterations, %d at a time\n",trials,iters,jobs);
+    double start=seconds();
+    int next=0, running=0, done=0;
+    while (done<trials)
+    {
+        while (running<jobs&&next<trials)
+        {
+            res[next].trial=next;
+            res[next].seed=seed+next;
+            pid[next]=startTrial(next,seed+next,iters,threads,start_particles,fd[1]);
+            if (pid[next]<0)
+            {
+                fprintf(stderr,"Unable to start trial %d\n",next);
+                done++;
+            }
+            else running++;
+            next++;
+        }
+        if (running==0) continue;
+
+        int status;
+        pid_t p=wait(&status);
+        if (p<0) break;
+        running--;
+        done++;
+        if (WIFEXITED(status)&&WEXITSTATUS(status)==0)
+        {
+            // A clean exit means one more result is waiting in the pipe
+            // (not necessarily this child's, but tagged with its trial)
+            struct trial_result r;
+            if (read(fd[0],&r,sizeof(r))==sizeof(r)&&r.trial>=0&&r.trial<trials)
+            {
+                res[r.trial]=r;
+                if (!r.ok) fprintf(stderr,"Trial %d (seed %ld) failed\n",r.trial,r.seed);
+            }
+        }
+        else
+        {
+            for (int t=0; t<next; t++)
+                if (pid[t]==p) fprintf(stderr,"Trial %d (seed %ld) failed\n",t,seed+t);
+        }
+    }
+    double wall=seconds()-start;
+
+    // A child killed after writing its result left it unread. With
+    // every child gone, closing our end makes the pipe end there.
+    close(fd[1]);
+    if (done==trials)
+    {
+        struct trial_result r;
+        while (read(fd[0],&r,sizeof(r))==sizeof(r))
+            if (r.trial>=0&&r.trial<trials) res[r.trial]=r;
+    }
+    close(fd[0]);
+
+    int ok=0, localized=0, close_enough=0;
+    double fps=0.0;
+    printf("trial,seed,localized_iter,localize_s,final_error,fps,particles\n");
+    for (int t=0; t<trials; t++)
+    {
+        struct trial_result *r=&res[t];
+        if (!r->ok)
+        {
+            printf("%d,%ld,,,,,\n",t,r->seed);
+            continue;
+        }
+        printf("%d,%ld,%d,%.3f,%.3f,%.1f,%d\n",r->trial,r->seed,r->localized_iter,r->localize_s,
+               r->final_error,r->fps,r->particles);
+        ok++;
+        fps+=r->fps;
+        if (r->localized_iter>0) localized++;
+        if (r->final_error<10.0) close_enough++;
+    }
+
+    fprintf(stderr,"%d trials in %.2f s (%d failed)\n",trials,wall,trials-ok);
+    if (ok>0)
+    {
+        int n=0;
+        for (int t=0; t<trials; t++) if (res[t].ok&&res[t].localized_iter>0) v[n++]=res[t].localized_iter;
+        qsort(v,n,sizeof(double),cmpDouble);
+        fprintf(stderr,"Localized: %d/%d (%.1f%%)",localized,ok,100.0*localized/ok);
+        if (n>0) fprintf(stderr,", iterations to localize median %.0f, p90 %.0f",percentile(v,n,0.5),percentile(v,n,0.9));
+        fprintf(stderr,"\n");
+
+        n=0;
+        for (int t=0; t<trials; t++) if (res[t].ok&&res[t].localized_iter>0) v[n++]=res[t].localize_s;
+        qsort(v,n,sizeof(double),cmpDouble);
+        if (n>0) fprintf(stderr,"Seconds to localize: median %.3f, p90 %.3f\n",percentile(v,n,0.5),percentile(v,n,0.9));
+
+        n=0;
+        for (int t=0; t<trials; t++) if (res[t].ok) v[n++]=res[t].final_error;
+        qsort(v,n,sizeof(double),cmpDouble);
+        fprintf(stderr,"Final error: median %.2f, p90 %.2f, max %.2f; within 10 px: %d/%d (%.1f%%)\n",
+                percentile(v,n,0.5),percentile(v,n,0.9),v[n-1],close_enough,ok,100.0*close_enough/ok);
+        fprintf(stderr,"Frames/s per trial: mean %.1f\n",fps/ok);
+    }
+
+    free(res);
+    free(pid);
+    free(v);
+    return localized;
+}
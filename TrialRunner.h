@@ -0,0 +1,52 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Monte Carlo trial runner.
+
+  Runs many independent localizations on one map, each from its own
+  robot start pose (initRobot()) and random seed, and aggregates
+  how they went into a single report.
+
+  Every trial runs in its own child process, up to 'jobs' of them
+  at a time. The filter keeps its state in globals, so processes are
+  the only way to run instances side by side. Trial t draws all its
+  random numbers from seed 'seed'+t (see RandomStream.h), so any
+  trial can be rerun on its own. The children are forked after the
+  map, the ray-cast table and the other read-only data are set up,
+  so all of them share those pages with the parent (copy-on-write,
+  never copied since nobody writes to them).
+
+  Each child sends back one 'struct trial_result' through a pipe.
+  One CSV row per trial goes to stdout:
+
+   trial,seed,localized_iter,localize_s,final_error,fps,particles
+
+  where localized_iter is the first iteration at which the cloud was
+  centralized (-1 if never), localize_s the time it took, fps the
+  iterations per second of the trial and particles the final
+  particle count. A summary goes to stderr.
+*/
+
+#ifndef __TrialRunner_header
+#define __TrialRunner_header
+
+struct trial_result{
+ int trial;
+ long seed;
+ int localized_iter;		// First centralized iteration, -1 if none
+ double localize_s;		// Seconds to localize
+ double final_error;		// Pose error after the last iteration
+ double fps;			// Iterations per second
+ int particles;			// Final particle count
+ int ok;			// 0 if the trial failed (e.g. crashed)
+};
+
+// Run 'trials' trials of 'iters' iterations each, at most 'jobs' at
+// a time (0 means one per CPU). Trial t uses seed 'seed'+t. The
+// filter's globals must be set up as for runHeadless(), except for
+// the robot, the particles and the thread pool, which every trial
+// creates for itself. Each trial uses a pool of 'threads' workers.
+// Returns the number of trials that localized.
+int runTrials(int trials, int jobs, int iters, long seed, int threads);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Double-buffered viewer snapshots. See ViewSnapshot.h
+*/
+
+#include "ViewSnapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+int initViewChannel(struct view_channel *c, int cap)
+{
+    memset(c,0,sizeof(struct view_channel));
+    if (initStore(&c->buf[0].set,cap,0)!=0||initStore(&c->buf[1].set,cap,0)!=0)
+    {
+        freeStore(&c->buf[0].set);
+        return -1;
+    }
+    pthread_mutex_init(&c->lock,NULL);
+    c->front=&c->buf[0];
+    c->back=&c->buf[1];
+    c->want=1;
+    return 0;
+}
+
+void freeViewChannel(struct view_channel *c)
+{
+    if (c->front==NULL) return;
+    freeStore(&c->buf[0].set);
+    freeStore(&c->buf[1].set);
+    pthread_mutex_destroy(&c->lock);
+    memset(c,0,sizeof(struct view_channel));
+}
+
+int viewPublish(struct view_channel *c, const struct particle_store *s, const struct particle *robot, double est_x, double est_y,
+                double est_theta, int iteration)
+{
+    // The back snapshot belongs to this thread until the swap below
+    struct view_snapshot *v=c->back;
+    if (v->set.cap<s->n)
+    {
+        freeStore(&v->set);
+        if (initStore(&v->set,s->n,0)!=0) return -1;
+    }
+
+    memcpy(v->set.x,s->x,s->n*sizeof(pf_pose));
+    memcpy(v->set.y,s->y,s->n*sizeof(pf_pose));
+    memcpy(v->set.theta,s->theta,s->n*sizeof(pf_pose));
+    memcpy(v->set.prob,s->prob,s->n*sizeof(double));
+    v->set.n=s->n;
+    v->est_x=est_x;
+    v->est_y=est_y;
+    v->est_theta=est_theta;
+    v->robot=*robot;
+    v->robot.next=NULL;
+    v->iteration=iteration;
+
+    pthread_mutex_lock(&c->lock);
+    c->back=c->front;
+    c->front=v;
+    c->fresh=1;
+    __atomic_store_n(&c->want,0,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+struct view_snapshot *viewAcquire(struct view_channel *c)
+{
+    pthread_mutex_lock(&c->lock);
+    if (!c->fresh) return NULL;
+    c->fresh=0;
+    return c->front;
+}
+
+void viewRelease(struct view_channel *c)
+{
+    __atomic_store_n(&c->want,1,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&c->lock);
+}
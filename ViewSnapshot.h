@@ -0,0 +1,79 @@
+/*
+  CSC C85 - Fundamentals of Robotics and Automated Systems
+
+  Double-buffered snapshots of the filter state for the viewer.
+
+  The viewer used to run one filter iteration per displayed frame,
+  so the filter could never go faster than the display: every
+  iteration also paid for a full renderFrame(), a texture upload
+  and a scan for the best particle, and then waited for vsync.
+
+  With the filter on its own thread, the two sides only meet here.
+  The channel holds two snapshots:
+
+   front - the latest published state, drawn by the viewer
+   back  - owned by the filter thread, filled while the viewer
+           draws the front one
+
+  The filter only fills a snapshot when the viewer has asked for
+  one (viewWanted()), so the copy costs O(N) per displayed frame,
+  not per iteration. viewPublish() swaps the two under the lock.
+  The viewer holds the lock while drawing the front snapshot; the
+  filter can only be blocked by that if it publishes a frame the
+  viewer has not asked for yet, which it never does.
+
+  A snapshot keeps the pose and belief of every particle (no
+  measurements), a copy of the robot, and the reported pose
+  estimate (see reportedPose()).
+*/
+
+#ifndef __ViewSnapshot_header
+#define __ViewSnapshot_header
+
+#include <pthread.h>
+#include "ParticleStore.h"
+
+struct view_snapshot{
+ struct particle_store set;	// Poses and beliefs (no measurements)
+ struct particle robot;		// Copy of the robot, 'next' is NULL
+ double est_x, est_y, est_theta;	// Pose estimate
+ int iteration;			// Filter iterations run so far
+};
+
+struct view_channel{
+ pthread_mutex_t lock;
+ struct view_snapshot buf[2];
+ struct view_snapshot *front;	// Published, read by the viewer
+ struct view_snapshot *back;	// Filled by the filter thread
+ int fresh;			// front not drawn yet
+ int want;			// Viewer is ready for a new snapshot
+};
+
+// Set up a channel with room for 'cap' particles per snapshot
+// (snapshots grow if the set does). Returns 0 on success, -1 if out
+// of memory.
+int initViewChannel(struct view_channel *c, int cap);
+
+// Release the channel. Both threads must be done with it.
+void freeViewChannel(struct view_channel *c);
+
+// Filter side: true if the viewer is waiting for a new snapshot
+static inline int viewWanted(struct view_channel *c)
+{
+ return __atomic_load_n(&c->want,__ATOMIC_ACQUIRE);
+}
+
+// Filter side: copy the particle set, robot and pose estimate
+// (est_x, est_y, est_theta) into the back snapshot and make it the
+// front one. Returns -1 if the snapshot could not grow to fit the set
+// (nothing is published).
+int viewPublish(struct view_channel *c, const struct particle_store *s, const struct particle *robot, double est_x, double est_y,
+                double est_theta, int iteration);
+
+// Viewer side: lock the channel and return the front snapshot if
+// it has not been drawn yet, NULL otherwise. Always follow with
+// viewRelease(), which also asks the filter for the next snapshot.
+struct view_snapshot *viewAcquire(struct view_channel *c);
+void viewRelease(struct view_channel *c);
+
+#endif
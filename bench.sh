@@ -0,0 +1,11 @@
+# Build and run the per-kernel micro-benchmarks (see ParticleBench.c).
+# Any arguments are passed on, e.g.
+#   sh bench.sh --reps 50 --sizes 1000,50000 maze.ppm
+# Results go to stdout and to bench_results.csv
+
+# ParticleFilters.c is compiled without its main(), the benchmark has its own
+# (add -DPF_COMPACT for the compact particle format, see ParticleStore.h)
+g++ -O3 -DPF_NO_MAIN ParticleBench.c ParticleFilters.c ParticleStore.c RayTable.c ThreadPool.c ParticleMotion.c Resample.c Likelihood.c LikelihoodField.c FilterStats.c KldSampling.c TrialRunner.c FreeSpace.c OccupancyGrid.c RayBatch.c FrameEstimate.c PoseClusters.c MapCache.c ViewSnapshot.c RandomStream.c MeasureMemo.c SpatialSort.c \
+    -no-pie ParticleUtils.o -g -pthread -lGL -lGLU -lglut -o ParticleBench || exit 1
+
+./ParticleBench "$@"
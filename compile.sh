@@ -1,10 +1,10 @@
 # g++ -c -O3 ParticleFilters.c
 # g++  *.o -O3 -g -lGL -lGLU -lglut -o ParticleFilters
 
-# Compile ParticleFilters.c
-g++ -c -O3 ParticleFilters.c
+# Compile ParticleFilters.c and its modules. Add -DPF_COMPACT to
+# all g++ lines (and to bench.sh) for the compact particle format,
+# see ParticleStore.h
+g++ -c -O3 ParticleFilters.c ParticleStore.c RayTable.c ThreadPool.c ParticleMotion.c Resample.c Likelihood.c LikelihoodField.c FilterStats.c KldSampling.c TrialRunner.c FreeSpace.c OccupancyGrid.c RayBatch.c FrameEstimate.c PoseClusters.c MapCache.c ViewSnapshot.c RandomStream.c MeasureMemo.c SpatialSort.c
 
 # Link all object files with -no-pie to avoid PIE enforcement
-g++ -no-pie *.o -O3 -g -lGL -lGLU -lglut -o ParticleFilters
-
-
+g++ -no-pie *.o -O3 -g -pthread -lGL -lGLU -lglut -o ParticleFilters